@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include "stm32l4xx_hal.h"
+#include "AudioDMA.h"
+
+//Overwrite the weak default IRQ Handler
+extern "C" void DMA1_Channel3_IRQHandler(void);
+
+//Pointer to user ISR
+void (*AudioDMA_BlockISR)(uint32_t *frames, uint32_t count) = NULL;
+
+//DMA handle struct, filled in at initialisation
+DMA_HandleTypeDef DAC_DMA_Handle = {};
+
+//Two blocks of frames, read by the DMA
+uint32_t audioRing[2 * AUDIO_BLOCK_FRAMES];
+
+
+static void fillRing(uint32_t frame) {
+  for (uint32_t i = 0; i < 2 * AUDIO_BLOCK_FRAMES; i++)
+    audioRing[i] = frame;
+}
+
+
+//The first half has been sent, refill it while the second half plays
+static void ringHalfDone(DMA_HandleTypeDef *hdma) {
+  if (AudioDMA_BlockISR)
+    AudioDMA_BlockISR(&audioRing[0], AUDIO_BLOCK_FRAMES);
+}
+
+
+static void ringDone(DMA_HandleTypeDef *hdma) {
+  if (AudioDMA_BlockISR)
+    AudioDMA_BlockISR(&audioRing[AUDIO_BLOCK_FRAMES], AUDIO_BLOCK_FRAMES);
+}
+
+
+//TIM6 runs from the APB1 timer clock, twice PCLK1 when APB1 is divided
+static uint32_t timerClock() {
+  uint32_t clock = HAL_RCC_GetPCLK1Freq();
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+    clock *= 2;
+  return clock;
+}
+
+
+uint32_t AudioDMA_Init(uint32_t sampleRate) {
+  __HAL_RCC_DAC1_CLK_ENABLE();
+  __HAL_RCC_TIM6_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+
+  //PA4 and PA5 are the DAC outputs
+  GPIO_InitTypeDef GPIO_InitDAC = {
+    GPIO_PIN_4 | GPIO_PIN_5,  //PA4 is channel 1, PA5 is channel 2
+    GPIO_MODE_ANALOG,         //Analog, digital path disconnected
+    GPIO_NOPULL,
+    GPIO_SPEED_FREQ_LOW,
+    0
+    };
+  HAL_GPIO_Init(GPIOA, &GPIO_InitDAC);
+
+  //TIM6 update event is the trigger output
+  TIM6->CR1 = 0;
+  TIM6->PSC = 0;
+  TIM6->CR2 = TIM_CR2_MMS_1;
+  AudioDMA_SetRate(sampleRate);
+
+  //Both channels buffered and triggered by TIM6 TRGO (TSEL = 0), DMA requests from channel 1 only
+  //Set up with the trigger off so the parked value reaches the outputs straight away
+  DAC1->MCR = 0;
+  DAC1->CR = DAC_CR_DMAEN1;
+  DAC1->DHR12RD = AUDIO_SILENT_FRAME;
+  DAC1->CR |= DAC_CR_EN1 | DAC_CR_EN2;
+  fillRing(AUDIO_SILENT_FRAME);
+
+  //DMA1 channel 3 request 6 is DAC channel 1
+  DAC_DMA_Handle.Instance = DMA1_Channel3;
+  DAC_DMA_Handle.Init.Request = DMA_REQUEST_6;
+  DAC_DMA_Handle.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  DAC_DMA_Handle.Init.PeriphInc = DMA_PINC_DISABLE;
+  DAC_DMA_Handle.Init.MemInc = DMA_MINC_ENABLE;
+  DAC_DMA_Handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  DAC_DMA_Handle.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  DAC_DMA_Handle.Init.Mode = DMA_CIRCULAR;
+  DAC_DMA_Handle.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+  uint32_t status = (uint32_t) HAL_DMA_Init(&DAC_DMA_Handle);
+  if (status != HAL_OK)
+    return status;
+  DAC_DMA_Handle.XferHalfCpltCallback = ringHalfDone;
+  DAC_DMA_Handle.XferCpltCallback = ringDone;
+
+  //Below CAN, the display and the host link (6) so their short handlers can
+  //preempt a block render, above every task; FreeRTOS calls are allowed
+  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 7, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+
+  //The DMA waits for requests, which only come while TIM6 runs
+  return (uint32_t) HAL_DMA_Start_IT(&DAC_DMA_Handle, (uint32_t)audioRing, (uint32_t)&DAC1->DHR12RD,
+                                     2 * AUDIO_BLOCK_FRAMES);
+}
+
+
+void AudioDMA_SetRate(uint32_t sampleRate) {
+  TIM6->ARR = (timerClock() + sampleRate / 2) / sampleRate - 1;
+  TIM6->EGR = TIM_EGR_UG;
+}
+
+
+void AudioDMA_Start() {
+  DAC1->CR |= DAC_CR_TEN1 | DAC_CR_TEN2;
+  TIM6->CR1 |= TIM_CR1_CEN;
+}
+
+
+void AudioDMA_Stop(uint32_t frame) {
+  TIM6->CR1 &= ~TIM_CR1_CEN;
+  //With the trigger off the data register reaches the outputs on the next clock
+  DAC1->CR &= ~(DAC_CR_TEN1 | DAC_CR_TEN2);
+  DAC1->DHR12RD = frame;
+  //Nothing stale plays on restart
+  fillRing(frame);
+}
+
+
+void AudioDMA_RegisterBlockISR(void(& callback)(uint32_t *frames, uint32_t count)) {
+  AudioDMA_BlockISR = &callback;
+}
+
+
+//This is the base IRQ handler for DMA1 channel 3
+//It calls the HAL handler, which clears the flags and runs the callbacks
+void DMA1_Channel3_IRQHandler(void) {
+  HAL_DMA_IRQHandler(&DAC_DMA_Handle);
+}
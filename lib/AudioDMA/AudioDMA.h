@@ -0,0 +1,34 @@
+#include <stdint.h>
+
+//Stereo audio output on both DAC channels from a single DMA stream
+//TIM6 triggers DAC channels 1 and 2 together at the sample rate, and one
+//circular DMA transfer feeds the dual 12-bit data register, so each sample
+//frame is one word: bits 0-11 channel 1 (PA4, right), bits 16-27 channel 2
+//(PA5, left). The ring holds two blocks; the block callback refills one half
+//while the other plays, so there is one interrupt per block, not per sample
+
+//Frames per block, one interrupt each
+const uint32_t AUDIO_BLOCK_FRAMES = 32;
+
+//Pack a frame from unsigned 12-bit samples
+inline uint32_t AudioDMA_Frame(uint16_t left, uint16_t right) {
+  return ((uint32_t)left << 16) | right;
+}
+
+//Both channels at mid-scale
+const uint32_t AUDIO_SILENT_FRAME = 0x08000800;
+
+//Set up the DAC, TIM6 and the DMA; the output stays parked until AudioDMA_Start
+uint32_t AudioDMA_Init(uint32_t sampleRate);
+
+//Change the sample rate, while stopped or running
+void AudioDMA_SetRate(uint32_t sampleRate);
+
+//Start the sample clock
+void AudioDMA_Start();
+
+//Stop the sample clock, clear the ring and hold both outputs at frame
+void AudioDMA_Stop(uint32_t frame = AUDIO_SILENT_FRAME);
+
+//Set up an interrupt to fill each block of AUDIO_BLOCK_FRAMES frames
+void AudioDMA_RegisterBlockISR(void(& callback)(uint32_t *frames, uint32_t count));
@@ -0,0 +1,259 @@
+#include <Arduino.h>
+#include "stm32l4xx_hal.h"
+#include "DisplayDMA.h"
+
+//Overwrite the weak default IRQ Handlers and callbacks
+extern "C" void I2C1_EV_IRQHandler(void);
+extern "C" void I2C1_ER_IRQHandler(void);
+extern "C" void DMA2_Channel7_IRQHandler(void);
+
+//Pointer to user ISR
+void (*DisplayDMA_DoneISR)() = NULL;
+
+//I2C and DMA handle structs, filled in at initialisation
+I2C_HandleTypeDef I2C_Handle = {};
+DMA_HandleTypeDef I2C_DMA_Handle = {};
+
+//Every u8x8 start/end transfer pair becomes one I2C write
+//The SSD13xx command layer sends at most 24 data bytes plus a control byte per write
+const uint8_t CHUNK_SIZE = 32;
+const uint8_t CHUNK_COUNT = 32;   //A full frame is 28 writes
+
+struct I2CChunk {
+  uint8_t address;
+  uint8_t length;
+  uint8_t data[CHUNK_SIZE];
+};
+
+I2CChunk chunks[CHUNK_COUNT];
+volatile uint8_t chunkHead = 0;   //Next chunk to fill (task)
+volatile uint8_t chunkTail = 0;   //Chunk being sent (ISR)
+volatile bool dmaBusy = false;
+volatile uint32_t burstStartTime = 0;
+volatile uint32_t lastTransferTime = 0;
+volatile uint32_t errorCount = 0;
+
+
+//Initialise I2C dependencies: GPIO, clocks, DMA and interrupts
+void HAL_I2C_MspInit(I2C_HandleTypeDef* hi2c) {
+
+  //Set up the pin initialisation
+  GPIO_InitTypeDef GPIO_InitI2C = {
+    GPIO_PIN_6 | GPIO_PIN_7,  //PB6 is SCL, PB7 is SDA
+    GPIO_MODE_AF_OD,          //Alternate function, open-drain driver
+    GPIO_PULLUP,              //Pull-up enabled
+    GPIO_SPEED_FREQ_HIGH,     //High slew rate
+    GPIO_AF4_I2C1             //Alternate function is I2C
+    };
+
+  //Clock I2C1 from PCLK1 so the timing value matches
+  RCC_PeriphCLKInitTypeDef clockInit = {};
+  clockInit.PeriphClockSelection = RCC_PERIPHCLK_I2C1;
+  clockInit.I2c1ClockSelection = RCC_I2C1CLKSOURCE_PCLK1;
+  HAL_RCCEx_PeriphCLKConfig(&clockInit);
+
+  //Enable the I2C, DMA and GPIO clocks
+  __HAL_RCC_I2C1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+
+  //Initialise the pins
+  HAL_GPIO_Init(GPIOB, &GPIO_InitI2C);
+
+  //DMA2 channel 7 request 5 is I2C1 TX (DMA1 channel 6 carries the host link)
+  I2C_DMA_Handle.Instance = DMA2_Channel7;
+  I2C_DMA_Handle.Init.Request = DMA_REQUEST_5;
+  I2C_DMA_Handle.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  I2C_DMA_Handle.Init.PeriphInc = DMA_PINC_DISABLE;
+  I2C_DMA_Handle.Init.MemInc = DMA_MINC_ENABLE;
+  I2C_DMA_Handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  I2C_DMA_Handle.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  I2C_DMA_Handle.Init.Mode = DMA_NORMAL;
+  I2C_DMA_Handle.Init.Priority = DMA_PRIORITY_LOW;
+  HAL_DMA_Init(&I2C_DMA_Handle);
+  __HAL_LINKDMA(hi2c, hdmatx, I2C_DMA_Handle);
+
+  //Switch on the interrupts, same priority as CAN so FreeRTOS calls are allowed
+  HAL_NVIC_SetPriority(DMA2_Channel7_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Channel7_IRQn);
+  HAL_NVIC_SetPriority(I2C1_EV_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+  HAL_NVIC_SetPriority(I2C1_ER_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
+}
+
+
+static uint32_t DisplayDMA_Init() {
+  //Timing from CubeMX with fast mode (400kHz) and clock frequency = 80MHz
+  I2C_Handle.Instance = I2C1;
+  I2C_Handle.Init.Timing = 0x00702991;
+  I2C_Handle.Init.OwnAddress1 = 0;
+  I2C_Handle.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+  I2C_Handle.Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
+  I2C_Handle.Init.OwnAddress2 = 0;
+  I2C_Handle.Init.OwnAddress2Masks = I2C_OA2_NOMASK;
+  I2C_Handle.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
+  I2C_Handle.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
+  uint32_t status = (uint32_t) HAL_I2C_Init(&I2C_Handle);
+  HAL_I2CEx_ConfigAnalogFilter(&I2C_Handle, I2C_ANALOGFILTER_ENABLE);
+  return status;
+}
+
+
+//Start sending the chunk at the tail of the queue
+static void startChunk() {
+  I2CChunk &chunk = chunks[chunkTail];
+  if (HAL_I2C_Master_Transmit_DMA(&I2C_Handle, chunk.address, chunk.data, chunk.length) != HAL_OK) {
+    //Peripheral refused the transfer, drop the whole queue rather than spin in the ISR
+    errorCount++;
+    chunkTail = chunkHead;
+    dmaBusy = false;
+  }
+}
+
+
+//Move on to the next chunk, or finish the burst
+static void chunkDone() {
+  chunkTail = (chunkTail + 1) % CHUNK_COUNT;
+  if (chunkTail != chunkHead) {
+    startChunk();
+    return;
+  }
+  dmaBusy = false;
+  lastTransferTime = micros() - burstStartTime;
+
+  //Call the user ISR if it has been registered
+  if (DisplayDMA_DoneISR)
+    DisplayDMA_DoneISR();
+}
+
+
+extern "C" uint8_t u8x8_byte_dma_i2c(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr) {
+  switch (msg) {
+    case U8X8_MSG_BYTE_INIT:
+      DisplayDMA_Init();
+      break;
+
+    case U8X8_MSG_BYTE_SET_DC:
+      break;
+
+    case U8X8_MSG_BYTE_START_TRANSFER: {
+      //Wait for the ISR to free a chunk if the queue is full
+      while ((chunkHead + 1) % CHUNK_COUNT == chunkTail);
+      I2CChunk &chunk = chunks[chunkHead];
+      chunk.address = u8x8_GetI2CAddress(u8x8);
+      chunk.length = 0;
+      break;
+    }
+
+    case U8X8_MSG_BYTE_SEND: {
+      //Copy the data so u8g2 can keep drawing into its buffer
+      I2CChunk &chunk = chunks[chunkHead];
+      uint8_t count = arg_int;
+      if (chunk.length + count > CHUNK_SIZE) {
+        count = CHUNK_SIZE - chunk.length;
+        errorCount++;
+      }
+      memcpy(&chunk.data[chunk.length], arg_ptr, count);
+      chunk.length += count;
+      break;
+    }
+
+    case U8X8_MSG_BYTE_END_TRANSFER: {
+      //Publish the chunk and kick off the DMA if it is idle
+      uint32_t primask = __get_PRIMASK();
+      __disable_irq();
+      chunkHead = (chunkHead + 1) % CHUNK_COUNT;
+      if (!dmaBusy) {
+        dmaBusy = true;
+        burstStartTime = micros();
+        startChunk();
+      }
+      __set_PRIMASK(primask);
+      break;
+    }
+
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+
+extern "C" uint8_t u8x8_gpio_and_delay_dma(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr) {
+  //Delays in the init sequence must happen on the bus, so drain the queue first
+  switch (msg) {
+    case U8X8_MSG_DELAY_MILLI:
+      DisplayDMA_WaitIdle();
+      delay(arg_int);
+      break;
+
+    case U8X8_MSG_DELAY_10MICRO:
+      DisplayDMA_WaitIdle();
+      delayMicroseconds(arg_int * 10);
+      break;
+
+    case U8X8_MSG_DELAY_100NANO:
+      DisplayDMA_WaitIdle();
+      delayMicroseconds(1);
+      break;
+
+    default:
+      break;
+  }
+  return 1;
+}
+
+
+bool DisplayDMA_Busy() {
+  return dmaBusy;
+}
+
+
+void DisplayDMA_WaitIdle() {
+  while (dmaBusy);
+}
+
+
+uint32_t DisplayDMA_GetLastTransferTime() {
+  return lastTransferTime;
+}
+
+
+uint32_t DisplayDMA_GetErrorCount() {
+  return errorCount;
+}
+
+
+void DisplayDMA_RegisterDoneISR(void(& callback)()) {
+  //Store pointer to user ISR
+  DisplayDMA_DoneISR = &callback;
+}
+
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef * hi2c) {
+  chunkDone();
+}
+
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef * hi2c) {
+  //Drop the chunk (e.g. display not connected) and carry on with the rest
+  errorCount++;
+  chunkDone();
+}
+
+
+//These are the base ISRs at the interrupt vectors
+void I2C1_EV_IRQHandler(void) {
+  HAL_I2C_EV_IRQHandler(&I2C_Handle);
+}
+
+
+void I2C1_ER_IRQHandler(void) {
+  HAL_I2C_ER_IRQHandler(&I2C_Handle);
+}
+
+
+void DMA2_Channel7_IRQHandler(void) {
+  HAL_DMA_IRQHandler(&I2C_DMA_Handle);
+}
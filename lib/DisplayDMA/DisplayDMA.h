@@ -0,0 +1,29 @@
+#include <U8g2lib.h>
+
+//u8x8 callbacks that queue I2C transfers to DMA instead of blocking on Wire
+extern "C" uint8_t u8x8_byte_dma_i2c(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
+extern "C" uint8_t u8x8_gpio_and_delay_dma(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
+
+//SSD1305 128x32 display on I2C1 (PB7 SDA, PB6 SCL) with DMA transfers
+//Drawing calls return as soon as the data is copied into the transfer queue
+class U8G2_SSD1305_128X32_ADAFRUIT_F_DMA_I2C : public U8G2 {
+  public:
+    U8G2_SSD1305_128X32_ADAFRUIT_F_DMA_I2C(const u8g2_cb_t *rotation) : U8G2() {
+      u8g2_Setup_ssd1305_i2c_128x32_adafruit_f(&u8g2, rotation, u8x8_byte_dma_i2c, u8x8_gpio_and_delay_dma);
+    }
+};
+
+//Check if queued transfers are still in progress
+bool DisplayDMA_Busy();
+
+//Block until all queued transfers have finished
+void DisplayDMA_WaitIdle();
+
+//Duration of the last complete burst of transfers in microseconds
+uint32_t DisplayDMA_GetLastTransferTime();
+
+//Number of transfers dropped after a bus error or NACK
+uint32_t DisplayDMA_GetErrorCount();
+
+//Set up an interrupt for when the transfer queue runs empty
+void DisplayDMA_RegisterDoneISR(void(& callback)());
@@ -0,0 +1,7 @@
+#include "Dither.h"
+
+
+void Dither_Reset(Dither &state, uint32_t seed) {
+  state.seed = seed;
+  state.error = 0;
+}
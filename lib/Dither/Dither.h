@@ -0,0 +1,60 @@
+#include <stdint.h>
+
+//Output quantiser: reduces a signed 16-bit sample to an unsigned DAC code
+//Shared by the firmware and the host SNR tool
+//Plain C++ with no Arduino or HAL dependencies so it builds on both
+
+//Resolution of the L432's DAC
+const uint8_t DITHER_DAC_BITS = 12;
+
+enum DitherMode : uint8_t {
+  DITHER_OFF,          //Round to the nearest code
+  DITHER_TPDF,         //Add triangular noise of +-1 code before rounding
+  DITHER_SHAPED,       //TPDF with first-order error feedback: noise moves up in frequency
+  DITHER_MODE_COUNT,
+};
+
+//One per output channel
+struct Dither {
+  uint32_t seed;       //Noise generator state
+  int32_t error;       //Last total error, in 16-bit units, for the shaper
+};
+
+//Clear the shaper and seed the noise; channels need different seeds
+void Dither_Reset(Dither &state, uint32_t seed);
+
+//Quantise a sample (-32768..32767) to a code of the given width (1..8 bits
+//dropped), 0 to 2^bits - 1 with mid-scale at zero
+//Inline so the sample loop avoids a call per channel
+inline uint16_t Dither_Quantise(Dither &state, int32_t sample, DitherMode mode,
+                                uint8_t bits = DITHER_DAC_BITS) {
+  const uint8_t shift = 16 - bits;
+  const int32_t step = 1 << shift;
+  const int32_t top = (1 << bits) - 1;
+
+  int32_t wanted = sample + 32768;
+  if (mode == DITHER_SHAPED)
+    wanted -= state.error;
+
+  int32_t value = wanted;
+  if (mode != DITHER_OFF) {
+    //Two uniform values from the top bits of one LCG step, difference is triangular
+    state.seed = state.seed * 1664525u + 1013904223u;
+    int32_t a = state.seed >> (32 - shift);
+    int32_t b = (state.seed >> (24 - shift)) & (step - 1);
+    value += a - b;
+  }
+
+  int32_t code = (value + step / 2) >> shift;
+  if (code < 0) code = 0;
+  if (code > top) code = top;
+
+  if (mode == DITHER_SHAPED) {
+    //Error including the dither, limited so clipping cannot wind it up
+    int32_t error = (code << shift) - wanted;
+    if (error > 2 * step) error = 2 * step;
+    if (error < -2 * step) error = -2 * step;
+    state.error = error;
+  }
+  return code;
+}
@@ -12,6 +12,9 @@ extern "C" void CAN1_TX_IRQHandler(void);
 void (*CAN_RX_ISR)() = NULL;
 void (*CAN_TX_ISR)() = NULL;
 
+//Mailbox being reported to the TX ISR
+volatile uint32_t txCompleteMailbox = 0;
+
 //CAN handle struct with initialisation parameters
 //Timing from http://www.bittiming.can-wiki.info/ with bit rate = 125kHz and clock frequency = 80MHz
 CAN_HandleTypeDef CAN_Handle = {
@@ -91,12 +94,32 @@ uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank) {
 }
 
 
+uint32_t disableCANFilter(uint32_t filterBank) {
+
+  //Only the bank number and activation matter when disabling
+  CAN_FilterTypeDef filterInfo = {
+    0,                          //Filter ID
+    0,                          //Filter ID LSBs = 0
+    0,                          //Mask MSBs
+    0,                          //Mask LSBs = 0
+    0,                          //FIFO selection
+    filterBank & 0xf,           //Filter bank selection
+    CAN_FILTERMODE_IDMASK,      //Mask mode
+    CAN_FILTERSCALE_32BIT,      //32 bit IDs
+    CAN_FILTER_DISABLE,         //Disable filter
+    0                           //uint32_t SlaveStartFilterBank
+  };
+
+  return (uint32_t) HAL_CAN_ConfigFilter(&CAN_Handle, &filterInfo);
+}
+
+
 uint32_t CAN_Start() {
   return (uint32_t) HAL_CAN_Start(&CAN_Handle);
 }
 
 
-uint32_t CAN_TX(uint32_t ID, uint8_t data[8]) {
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8], uint32_t *mailbox) {
 
   //Set up the message header
   CAN_TxHeaderTypeDef txHeader = {
@@ -112,7 +135,11 @@ uint32_t CAN_TX(uint32_t ID, uint8_t data[8]) {
   while (!HAL_CAN_GetTxMailboxesFreeLevel(&CAN_Handle));
 
   //Start the transmission
-  return (uint32_t) HAL_CAN_AddTxMessage(&CAN_Handle, &txHeader, data, NULL);
+  uint32_t used = 0;
+  uint32_t status = (uint32_t) HAL_CAN_AddTxMessage(&CAN_Handle, &txHeader, data, &used);
+  if (mailbox)
+    *mailbox = used;
+  return status;
 }
 
 
@@ -178,6 +205,7 @@ void HAL_CAN_RxFifo0MsgPendingCallback (CAN_HandleTypeDef * hcan){
 void HAL_CAN_TxMailbox0CompleteCallback (CAN_HandleTypeDef * hcan){
 
   //Call the user ISR if it has been registered
+  txCompleteMailbox = CAN_TX_MAILBOX0;
   if (CAN_TX_ISR)
     CAN_TX_ISR();
 }
@@ -186,6 +214,7 @@ void HAL_CAN_TxMailbox0CompleteCallback (CAN_HandleTypeDef * hcan){
 void HAL_CAN_TxMailbox1CompleteCallback (CAN_HandleTypeDef * hcan){
 
   //Call the user ISR if it has been registered
+  txCompleteMailbox = CAN_TX_MAILBOX1;
   if (CAN_TX_ISR)
     CAN_TX_ISR();
 }
@@ -194,11 +223,17 @@ void HAL_CAN_TxMailbox1CompleteCallback (CAN_HandleTypeDef * hcan){
 void HAL_CAN_TxMailbox2CompleteCallback (CAN_HandleTypeDef * hcan){
 
   //Call the user ISR if it has been registered
+  txCompleteMailbox = CAN_TX_MAILBOX2;
   if (CAN_TX_ISR)
     CAN_TX_ISR();
 }
 
 
+uint32_t CAN_TxCompleteMailbox() {
+  return txCompleteMailbox;
+}
+
+
 //This is the base ISR at the interrupt vector
 void CAN1_RX0_IRQHandler(void){
 
@@ -10,8 +10,12 @@ uint32_t CAN_Start();
 //Defaults to receive everything
 uint32_t setCANFilter(uint32_t filterID=0, uint32_t maskID=0, uint32_t filterBank=0);
 
+//Switch off a receive filter bank
+uint32_t disableCANFilter(uint32_t filterBank);
+
 //Send a message
-uint32_t CAN_TX(uint32_t ID, uint8_t data[8]);
+//If mailbox is not NULL it receives the mailbox used (CAN_TX_MAILBOX0/1/2)
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8], uint32_t *mailbox=NULL);
 
 //Get the number of received messages
 uint32_t CAN_CheckRXLevel();
@@ -23,4 +27,7 @@ uint32_t CAN_RX(uint32_t &ID, uint8_t data[8]);
 uint32_t CAN_RegisterRX_ISR(void(& callback)());
 
 //Set up an interrupt on transmitted messages
-uint32_t CAN_RegisterTX_ISR(void(& callback)());
\ No newline at end of file
+uint32_t CAN_RegisterTX_ISR(void(& callback)());
+
+//Mailbox whose transmission completed, valid inside the TX ISR
+uint32_t CAN_TxCompleteMailbox();
\ No newline at end of file
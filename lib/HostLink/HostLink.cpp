@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include "stm32l4xx_hal.h"
+#include "HostLink.h"
+
+//Overwrite the weak default IRQ Handler
+extern "C" void DMA1_Channel6_IRQHandler(void);
+
+//Pointer to user ISR
+void (*HostLink_RxISR)() = NULL;
+
+//DMA handle struct, filled in at initialisation
+DMA_HandleTypeDef UART_RX_DMA_Handle = {};
+
+//Receive ring, written only by the DMA
+volatile uint8_t rxRing[HOST_RX_SIZE] __attribute__((aligned(4)));
+volatile uint32_t rxRead = 0;       //Bytes consumed since start (task)
+volatile uint32_t rxLaps = 0;       //Completed passes of the DMA (ISR)
+volatile uint32_t overrunCount = 0;
+volatile bool overrunPending = false;
+
+
+//Bytes written by the DMA since start, as of a half or full ring event
+static void checkOverrun(uint32_t written) {
+  if (written - rxRead > HOST_RX_SIZE) {
+    overrunCount++;
+    overrunPending = true;
+  }
+  if (HostLink_RxISR)
+    HostLink_RxISR();
+}
+
+
+static void rxHalfDone(DMA_HandleTypeDef *hdma) {
+  checkOverrun(rxLaps * HOST_RX_SIZE + HOST_RX_SIZE / 2);
+}
+
+
+static void rxDone(DMA_HandleTypeDef *hdma) {
+  rxLaps++;
+  checkOverrun(rxLaps * HOST_RX_SIZE);
+}
+
+
+uint32_t HostLink_Init() {
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  //DMA1 channel 6 request 2 is USART2 RX
+  UART_RX_DMA_Handle.Instance = DMA1_Channel6;
+  UART_RX_DMA_Handle.Init.Request = DMA_REQUEST_2;
+  UART_RX_DMA_Handle.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  UART_RX_DMA_Handle.Init.PeriphInc = DMA_PINC_DISABLE;
+  UART_RX_DMA_Handle.Init.MemInc = DMA_MINC_ENABLE;
+  UART_RX_DMA_Handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  UART_RX_DMA_Handle.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  UART_RX_DMA_Handle.Init.Mode = DMA_CIRCULAR;
+  UART_RX_DMA_Handle.Init.Priority = DMA_PRIORITY_HIGH;
+  uint32_t status = (uint32_t) HAL_DMA_Init(&UART_RX_DMA_Handle);
+  if (status != HAL_OK)
+    return status;
+  UART_RX_DMA_Handle.XferHalfCpltCallback = rxHalfDone;
+  UART_RX_DMA_Handle.XferCpltCallback = rxDone;
+
+  //Same priority as CAN so FreeRTOS calls are allowed
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+
+  status = (uint32_t) HAL_DMA_Start_IT(&UART_RX_DMA_Handle, (uint32_t)&USART2->RDR, (uint32_t)rxRing, HOST_RX_SIZE);
+  if (status != HAL_OK)
+    return status;
+
+  //Stop the Serial receive interrupts and hand RDR to the DMA
+  //Overrun detection must be off or the UART stops receiving after one
+  CLEAR_BIT(USART2->CR1, USART_CR1_UE);
+  CLEAR_BIT(USART2->CR1, USART_CR1_RXNEIE | USART_CR1_PEIE);
+  CLEAR_BIT(USART2->CR3, USART_CR3_EIE);
+  SET_BIT(USART2->CR3, USART_CR3_OVRDIS | USART_CR3_DMAR);
+  SET_BIT(USART2->CR1, USART_CR1_UE);
+  return HAL_OK;
+}
+
+
+const volatile uint8_t *HostLink_Buffer() {
+  return rxRing;
+}
+
+
+uint32_t HostLink_ReadIndex() {
+  return rxRead;
+}
+
+
+uint32_t HostLink_Available() {
+  uint32_t written = HOST_RX_SIZE - __HAL_DMA_GET_COUNTER(&UART_RX_DMA_Handle);
+  if (overrunPending) {
+    //Resynchronise; the parser skips to the next sync byte
+    overrunPending = false;
+    rxRead = (rxRead & ~HOST_RX_MASK) + written;
+  }
+  return (written - rxRead) & HOST_RX_MASK;
+}
+
+
+void HostLink_Consume(uint32_t count) {
+  rxRead = rxRead + count;
+}
+
+
+uint32_t HostLink_GetOverrunCount() {
+  return overrunCount;
+}
+
+
+void HostLink_RegisterRxISR(void(& callback)()) {
+  HostLink_RxISR = &callback;
+}
+
+
+//This is the base IRQ handler for DMA1 channel 6
+//It calls the HAL handler, which clears the flags and runs the callbacks
+void DMA1_Channel6_IRQHandler(void) {
+  HAL_DMA_IRQHandler(&UART_RX_DMA_Handle);
+}
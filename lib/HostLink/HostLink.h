@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include "HostProtocol.h"
+
+//Host link receive on USART2 (PA15 RX, the ST-Link virtual COM port)
+//A circular DMA transfer fills a ring that is parsed in place; Serial keeps
+//the UART and its interrupt-driven transmit path
+
+//Receive ring size, a power of two: 5 ms of traffic at 1 Mbaud
+const uint32_t HOST_RX_SIZE = 512;
+const uint32_t HOST_RX_MASK = HOST_RX_SIZE - 1;
+
+//Take over reception from Serial, call after Serial.begin()
+uint32_t HostLink_Init();
+
+//The receive ring, for HostProto_Parse and the HostProto_Get helpers
+const volatile uint8_t *HostLink_Buffer();
+
+//Ring index of the oldest unread byte (unmasked)
+uint32_t HostLink_ReadIndex();
+
+//Bytes received and not yet consumed
+//After an overrun the unread data is discarded and reading restarts at the DMA position
+uint32_t HostLink_Available();
+
+//Release bytes back to the DMA
+void HostLink_Consume(uint32_t count);
+
+//Number of times the DMA lapped the reader
+uint32_t HostLink_GetOverrunCount();
+
+//Set up an interrupt for each half of the ring filled
+void HostLink_RegisterRxISR(void(& callback)());
@@ -0,0 +1,107 @@
+#include "HostProtocol.h"
+
+//CRC-8 lookup table for polynomial 0x07, built by the compiler
+struct CRC8Table {
+  uint8_t value[256];
+  constexpr CRC8Table() : value() {
+    for (int i = 0; i < 256; i++) {
+      uint8_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+      }
+      value[i] = crc;
+    }
+  }
+};
+
+static constexpr CRC8Table crcTable;
+static_assert(crcTable.value[1] == 0x07 && crcTable.value[0x80] == 0x89, "CRC-8 table");
+
+
+uint8_t HostProto_CRC8(const volatile uint8_t *ring, uint32_t mask, uint32_t start, uint32_t length) {
+  uint8_t crc = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    crc = crcTable.value[crc ^ ring[(start + i) & mask]];
+  }
+  return crc;
+}
+
+
+HostParseResult HostProto_Parse(const volatile uint8_t *ring, uint32_t mask, uint32_t start,
+                                uint32_t available, HostFrame &frame) {
+  if (available == 0)
+    return HOST_FRAME_INCOMPLETE;
+  if (ring[start & mask] != HOST_SYNC)
+    return HOST_FRAME_BAD;
+  if (available < HOST_HEADER_SIZE)
+    return HOST_FRAME_INCOMPLETE;
+
+  uint8_t length = ring[(start + 2) & mask];
+  if (length > HOST_MAX_PAYLOAD)
+    return HOST_FRAME_BAD;
+  uint32_t size = length + HOST_FRAME_OVERHEAD;
+  if (available < size)
+    return HOST_FRAME_INCOMPLETE;
+
+  //CRC covers the type, the length and the payload
+  if (HostProto_CRC8(ring, mask, start + 1, length + 2) != ring[(start + size - 1) & mask])
+    return HOST_FRAME_BAD;
+
+  frame.type = ring[(start + 1) & mask];
+  frame.length = length;
+  frame.payload = start + HOST_HEADER_SIZE;
+  frame.size = size;
+  return HOST_FRAME_OK;
+}
+
+
+uint32_t HostProto_Encode(uint8_t type, const uint8_t *payload, uint8_t length, uint8_t *out) {
+  if (length > HOST_MAX_PAYLOAD)
+    return 0;
+  out[0] = HOST_SYNC;
+  out[1] = type;
+  out[2] = length;
+  for (uint8_t i = 0; i < length; i++)
+    out[HOST_HEADER_SIZE + i] = payload[i];
+  out[HOST_HEADER_SIZE + length] = HostProto_CRC8(out, 0xFFFFFFFF, 1, length + 2);
+  return length + HOST_FRAME_OVERHEAD;
+}
+
+
+uint16_t HostProto_Get16(const volatile uint8_t *ring, uint32_t mask, uint32_t index) {
+  return ring[index & mask] | (ring[(index + 1) & mask] << 8);
+}
+
+
+uint32_t HostProto_Get32(const volatile uint8_t *ring, uint32_t mask, uint32_t index) {
+  return HostProto_Get16(ring, mask, index) | ((uint32_t)HostProto_Get16(ring, mask, index + 2) << 16);
+}
+
+
+static void put32(uint8_t *out, uint32_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+
+void HostProto_PackTelemetry(const HostTelemetry &telemetry, uint8_t *out) {
+  put32(&out[0], telemetry.rxFrames);
+  put32(&out[4], telemetry.rxErrors);
+  put32(&out[8], telemetry.rxOverruns);
+  put32(&out[12], telemetry.txDropped);
+  out[16] = telemetry.activeNotes;
+  out[17] = telemetry.role;
+}
+
+
+void HostProto_UnpackTelemetry(const volatile uint8_t *ring, uint32_t mask, uint32_t index,
+                               HostTelemetry &telemetry) {
+  telemetry.rxFrames = HostProto_Get32(ring, mask, index);
+  telemetry.rxErrors = HostProto_Get32(ring, mask, index + 4);
+  telemetry.rxOverruns = HostProto_Get32(ring, mask, index + 8);
+  telemetry.txDropped = HostProto_Get32(ring, mask, index + 12);
+  telemetry.activeNotes = ring[(index + 16) & mask];
+  telemetry.role = ring[(index + 17) & mask];
+}
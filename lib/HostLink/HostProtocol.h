@@ -0,0 +1,81 @@
+#include <stdint.h>
+
+//Binary host link protocol, shared by the firmware and the host tool
+//Plain C++ with no Arduino or HAL dependencies so it builds on both
+
+//Frame layout: [0] HOST_SYNC, [1] type, [2] payload length, [3..] payload,
+//then a CRC-8 (polynomial 0x07) of the type, length and payload bytes
+//HOST_SYNC is not ASCII, so frames can share the line with plain log text
+const uint8_t HOST_SYNC = 0xA5;
+const uint8_t HOST_HEADER_SIZE = 3;
+const uint8_t HOST_FRAME_OVERHEAD = 4;   //Header and CRC
+const uint8_t HOST_MAX_PAYLOAD = 32;
+const uint8_t HOST_MAX_FRAME = HOST_MAX_PAYLOAD + HOST_FRAME_OVERHEAD;
+
+enum HostFrameType : uint8_t {
+  //Host to module
+  HOST_NOP = 0x00,          //Any payload, counted and ignored (throughput tests)
+  HOST_MIDI = 0x01,         //One 4-byte USB-MIDI event packet
+  HOST_PARAM = 0x02,        //[0] HostParam, [1..2] value (int16)
+  HOST_PING = 0x03,         //Any payload, echoed back in a HOST_PONG
+  //Module to host
+  HOST_MIDI_OUT = 0x81,     //One 4-byte USB-MIDI event packet per local key change
+  HOST_TELEMETRY = 0x82,    //HostTelemetry
+  HOST_PONG = 0x83,
+};
+
+//Parameters are the knob positions, as if the knob had been turned,
+//then settings that have no knob
+enum HostParam : uint8_t {
+  HOST_PARAM_KNOB0,         //Transpose
+  HOST_PARAM_KNOB1,
+  HOST_PARAM_KNOB2,         //Octave
+  HOST_PARAM_KNOB3,         //Volume
+  HOST_PARAM_PAN_MODE,      //0 by key, 1 by module, 2 random per note
+  HOST_PARAM_DITHER,        //0 off, 1 TPDF, 2 TPDF noise-shaped
+  HOST_PARAM_COUNT,
+};
+
+struct HostTelemetry {
+  uint32_t rxFrames;        //Valid frames received
+  uint32_t rxErrors;        //Bad length or CRC
+  uint32_t rxOverruns;      //Receive buffer laps lost
+  uint32_t txDropped;       //Frames not sent because the UART or its mutex was busy
+  uint8_t activeNotes;
+  uint8_t role;
+};
+const uint8_t HOST_TELEMETRY_SIZE = 18;
+
+//Position of a complete frame in a receive ring
+struct HostFrame {
+  uint8_t type;
+  uint8_t length;
+  uint32_t payload;         //Ring index of the first payload byte (unmasked)
+  uint32_t size;            //Whole frame, in bytes
+};
+
+enum HostParseResult {
+  HOST_FRAME_OK,            //frame describes a valid frame at start
+  HOST_FRAME_INCOMPLETE,    //Need more bytes
+  HOST_FRAME_BAD,           //No valid frame at start; skip a byte and retry
+};
+
+//Look for a frame at ring index start without copying it out of the ring
+//ring has mask + 1 bytes (a power of two); available bytes follow start
+HostParseResult HostProto_Parse(const volatile uint8_t *ring, uint32_t mask, uint32_t start,
+                                uint32_t available, HostFrame &frame);
+
+//CRC-8 of a run of ring bytes
+uint8_t HostProto_CRC8(const volatile uint8_t *ring, uint32_t mask, uint32_t start, uint32_t length);
+
+//Build a frame into out (at least HOST_MAX_FRAME bytes); returns its size, 0 if too long
+uint32_t HostProto_Encode(uint8_t type, const uint8_t *payload, uint8_t length, uint8_t *out);
+
+//Little-endian fields, read straight from a ring
+uint16_t HostProto_Get16(const volatile uint8_t *ring, uint32_t mask, uint32_t index);
+uint32_t HostProto_Get32(const volatile uint8_t *ring, uint32_t mask, uint32_t index);
+
+//Telemetry payload packing; out must hold HOST_TELEMETRY_SIZE bytes
+void HostProto_PackTelemetry(const HostTelemetry &telemetry, uint8_t *out);
+void HostProto_UnpackTelemetry(const volatile uint8_t *ring, uint32_t mask, uint32_t index,
+                               HostTelemetry &telemetry);
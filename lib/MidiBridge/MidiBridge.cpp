@@ -0,0 +1,83 @@
+#include <stddef.h>
+#include "MidiBridge.h"
+
+//Lowest and highest+1 MIDI notes that map to octaves 0-8
+const uint8_t NOTE_FIRST = 12;
+const uint8_t NOTE_END = 120;
+
+//Pointer to user note handler
+void (*MidiBridge_NoteCallback)(char type, uint8_t octave, uint8_t key, uint8_t value) = NULL;
+
+//Outbound ring, head written only by MidiBridge_MirrorKey, tail only by MidiBridge_TakePacket
+MidiPacket midiOutRing[MIDI_OUT_RING_SIZE];
+uint8_t midiOutHead = 0;          //Next slot to write
+uint8_t midiOutTail = 0;          //Next slot to read
+volatile uint32_t midiOutDropped = 0;
+
+
+void MidiBridge_RegisterNoteCallback(void(& callback)(char type, uint8_t octave, uint8_t key, uint8_t value)) {
+  MidiBridge_NoteCallback = &callback;
+}
+
+
+//Map a MIDI note to a note event
+static void injectNote(char type, uint8_t note, uint8_t value) {
+  if (note < NOTE_FIRST || note >= NOTE_END)
+    return;
+  if (MidiBridge_NoteCallback)
+    MidiBridge_NoteCallback(type, note / 12 - 1, note % 12, value);
+}
+
+
+bool MidiBridge_Receive(const uint8_t packet[4]) {
+  uint8_t cin = packet[0] & 0x0F;
+  uint8_t note = packet[2] & 0x7F;
+  uint8_t value = packet[3] & 0x7F;
+  if (cin == MIDI_CIN_NOTE_ON && value != 0) {
+    injectNote('P', note, value);
+    return true;
+  }
+  //Note on with velocity 0 is a note off
+  if (cin == MIDI_CIN_NOTE_OFF || cin == MIDI_CIN_NOTE_ON) {
+    injectNote('R', note, 0);
+    return true;
+  }
+  if (cin == MIDI_CIN_POLY_PRESSURE) {
+    injectNote('A', note, value);
+    return true;
+  }
+  return false;  //Controllers, SysEx etc. are ignored for now
+}
+
+
+void MidiBridge_MirrorKey(bool press, uint8_t note) {
+  uint8_t cin = press ? MIDI_CIN_NOTE_ON : MIDI_CIN_NOTE_OFF;
+  MidiPacket packet = {{ cin, (uint8_t)((cin << 4) | MIDI_CHANNEL), note,
+                         press ? MIDI_KEY_VELOCITY : (uint8_t)0 }};
+
+  uint8_t head = midiOutHead;
+  uint8_t next = (head + 1) % MIDI_OUT_RING_SIZE;
+  if (next == __atomic_load_n(&midiOutTail, __ATOMIC_ACQUIRE)) {
+    midiOutDropped = midiOutDropped + 1;
+    return;
+  }
+  midiOutRing[head] = packet;
+  //Publish the slot only after it is written
+  __atomic_store_n(&midiOutHead, next, __ATOMIC_RELEASE);
+}
+
+
+bool MidiBridge_TakePacket(MidiPacket &packet) {
+  uint8_t tail = midiOutTail;
+  if (tail == __atomic_load_n(&midiOutHead, __ATOMIC_ACQUIRE))
+    return false;
+  packet = midiOutRing[tail];
+  //Free the slot only after it is read
+  __atomic_store_n(&midiOutTail, (uint8_t)((tail + 1) % MIDI_OUT_RING_SIZE), __ATOMIC_RELEASE);
+  return true;
+}
+
+
+uint32_t MidiBridge_GetDroppedCount() {
+  return midiOutDropped;
+}
@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+//Transport-independent MIDI bridge using 4-byte USB-MIDI event packets
+//([0] cable/CIN, [1] status, [2] data 1, [3] data 2), shared by the firmware
+//and the host test
+//Plain C++ with no Arduino or HAL dependencies so it builds on both
+//A transport only needs to hand packets to MidiBridge_Receive and drain
+//MidiBridge_TakePacket
+
+const uint8_t MIDI_CIN_NOTE_OFF = 0x8;
+const uint8_t MIDI_CIN_NOTE_ON = 0x9;
+const uint8_t MIDI_CIN_POLY_PRESSURE = 0xA;
+const uint8_t MIDI_CHANNEL = 0;           //Channel 1
+const uint8_t MIDI_KEY_VELOCITY = 100;    //Keys are not velocity sensitive
+const uint8_t MIDI_OUT_RING_SIZE = 32;
+
+struct MidiPacket {
+  uint8_t data[4];
+};
+
+//Set up the function that plays or forwards a received note event
+//type is 'P' (press, value = velocity), 'R' (release, value = 0) or
+//'A' (key pressure, value = pressure), as in the first byte of a note frame
+//Notes outside octaves 0-8 are dropped before the callback
+void MidiBridge_RegisterNoteCallback(void(& callback)(char type, uint8_t octave, uint8_t key, uint8_t value));
+
+//Handle one inbound event packet; returns true if it was a note event
+bool MidiBridge_Receive(const uint8_t packet[4]);
+
+//Queue a local key event as a note on/off packet; drops (and counts) when full
+//The ring has one writer and one reader, so neither needs a lock
+void MidiBridge_MirrorKey(bool press, uint8_t note);
+
+//Take the oldest outbound packet; returns false when the ring is empty
+bool MidiBridge_TakePacket(MidiPacket &packet);
+
+//Outbound packets dropped because the ring was full
+uint32_t MidiBridge_GetDroppedCount();
@@ -0,0 +1,33 @@
+#include <math.h>
+#include "SVF.h"
+
+//Damping at zero and full resonance, Q12
+static const int32_t DAMPING_MAX = 2 << SVF_COEFF_SHIFT;          //Q = 0.5
+static const int32_t DAMPING_MIN = (1 << SVF_COEFF_SHIFT) / 5;    //Q = 5
+
+
+void SVF_Reset(SVF &filter) {
+  filter.low = 0;
+  filter.band = 0;
+  filter.f = 0;
+  filter.damping = DAMPING_MAX;
+  filter.cutoff = 0;
+  filter.resonance = -1;
+}
+
+
+bool SVF_Tune(SVF &filter, uint32_t cutoff, int32_t resonance) {
+  if (cutoff > SVF_MAX_CUTOFF) cutoff = SVF_MAX_CUTOFF;
+  if (resonance < 0) resonance = 0;
+  if (resonance > 32767) resonance = 32767;
+  if (cutoff == filter.cutoff && resonance == filter.resonance)
+    return false;
+
+  //f = 2 sin(pi fc / fs), with fc / fs = cutoff / 2^32
+  float ratio = cutoff * (1.0f / 4294967296.0f);
+  filter.f = (int32_t)(2.0f * sinf(3.14159265f * ratio) * (1 << SVF_COEFF_SHIFT) + 0.5f);
+  filter.damping = DAMPING_MAX - (int32_t)(((int64_t)(DAMPING_MAX - DAMPING_MIN) * resonance) >> 15);
+  filter.cutoff = cutoff;
+  filter.resonance = resonance;
+  return true;
+}
@@ -0,0 +1,49 @@
+#include <stdint.h>
+
+//Resonant state-variable filter (Chamberlin) in fixed point, one per voice
+//Shared by the firmware and the host benchmark
+//Plain C++ with no Arduino or HAL dependencies so it builds on both
+
+//Coefficients are Q12 and samples are scaled up by 16 inside the filter
+//The state is clamped so every product fits in 32 bits at any resonance
+const uint8_t SVF_COEFF_SHIFT = 12;
+const uint8_t SVF_SAMPLE_SHIFT = 4;
+const int32_t SVF_STATE_LIMIT = (1 << 17) - 1;
+
+//Highest cutoff as a phase step (fraction of the sample rate * 2^32): fs / 6
+//Above this the Chamberlin structure turns unstable at high resonance
+const uint32_t SVF_MAX_CUTOFF = 0xFFFFFFFFu / 6;
+
+struct SVF {
+  int32_t low;
+  int32_t band;
+  int32_t f;              //2 sin(pi fc / fs), Q12
+  int32_t damping;        //1 / Q, Q12
+  uint32_t cutoff;        //Parameters the coefficients were computed for
+  int32_t resonance;
+};
+
+//Clear the state and force the next SVF_Tune to compute coefficients
+void SVF_Reset(SVF &filter);
+
+//Set the cutoff (a phase step, as for an oscillator at that frequency) and
+//the resonance (0 to 32767, Q from 0.5 to 5)
+//Coefficients are only recomputed when either differs from the last call;
+//returns true if they were
+bool SVF_Tune(SVF &filter, uint32_t cutoff, int32_t resonance);
+
+//Filter one sample (-128..127 nominal) and return the low-pass output
+//Inline so the sample loop avoids a call per voice
+inline int32_t SVF_Process(SVF &filter, int32_t sample) {
+  int32_t input = sample << SVF_SAMPLE_SHIFT;
+  int32_t low = filter.low + ((filter.f * filter.band) >> SVF_COEFF_SHIFT);
+  if (low > SVF_STATE_LIMIT) low = SVF_STATE_LIMIT;
+  if (low < -SVF_STATE_LIMIT) low = -SVF_STATE_LIMIT;
+  int32_t high = input - low - ((filter.damping * filter.band) >> SVF_COEFF_SHIFT);
+  int32_t band = filter.band + ((filter.f * high) >> SVF_COEFF_SHIFT);
+  if (band > SVF_STATE_LIMIT) band = SVF_STATE_LIMIT;
+  if (band < -SVF_STATE_LIMIT) band = -SVF_STATE_LIMIT;
+  filter.low = low;
+  filter.band = band;
+  return low >> SVF_SAMPLE_SHIFT;
+}
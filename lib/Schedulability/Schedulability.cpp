@@ -0,0 +1,129 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Schedulability.h"
+
+static uint32_t deadlineOf(const SchedTask &task) {
+  return task.deadline ? task.deadline : task.period;
+}
+
+//Time to finish the first q + 1 releases of task i from a critical instant:
+//the smallest w with w = (q + 1) * C_i + sum over other tasks j of equal or
+//higher priority of ceil(w / T_j) * C_j. Returns false once w passes limit
+static bool busyWindow(const SchedTask *tasks, uint8_t count, uint8_t i, uint32_t q, uint64_t limit, uint64_t &window) {
+  window = (uint64_t)(q + 1) * tasks[i].wcet;
+
+  while (window <= limit) {
+    uint64_t next = (uint64_t)(q + 1) * tasks[i].wcet;
+    for (uint8_t j = 0; j < count; j++) {
+      if (j == i || tasks[j].priority < tasks[i].priority || tasks[j].period == 0) continue;
+      uint64_t releases = (window + tasks[j].period - 1) / tasks[j].period;
+      next += releases * tasks[j].wcet;
+    }
+    if (next == window) return true;
+    window = next;
+  }
+  return false;
+}
+
+//Worst-case response time of task i over every release in the level-i busy
+//period (needed when the deadline exceeds the period, exact otherwise)
+//Returns false if any release misses the deadline
+static bool responseTime(const SchedTask *tasks, uint8_t count, uint8_t i, uint32_t &response) {
+  uint64_t deadline = deadlineOf(tasks[i]);
+  uint64_t worst = 0;
+
+  for (uint32_t q = 0; ; q++) {
+    uint64_t release = (uint64_t)q * tasks[i].period;
+    uint64_t window;
+    if (!busyWindow(tasks, count, i, q, release + deadline, window)) return false;
+    if (window - release > worst) worst = window - release;
+    //The busy period ends before the next release, so later ones repeat it
+    if (window <= release + tasks[i].period) break;
+  }
+  response = (uint32_t)worst;
+  return true;
+}
+
+
+SchedResult Sched_Analyse(SchedTask *tasks, uint8_t count) {
+  SchedResult result = {};
+  result.schedulable = true;
+
+  double utilisation = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (tasks[i].period > 0) utilisation += (double)tasks[i].wcet / tasks[i].period;
+  }
+  double bound = count ? count * (pow(2.0, 1.0 / count) - 1.0) : 1.0;
+  result.utilisation = (uint32_t)(utilisation * 1000 + 0.5);
+  result.bound = (uint32_t)(bound * 1000);
+  result.withinBound = utilisation <= bound;
+
+  for (uint8_t i = 0; i < count; i++) {
+    tasks[i].response = 0;
+    tasks[i].schedulable = tasks[i].period && responseTime(tasks, count, i, tasks[i].response);
+    if (!tasks[i].schedulable) result.schedulable = false;
+  }
+  return result;
+}
+
+
+bool Sched_ParseCSV(const char *line, SchedTask &task, char *nameBuffer, uint8_t nameSize) {
+  const char *comma = strchr(line, ',');
+  if (!comma || comma == line || nameSize == 0) return false;
+
+  //The first three numeric fields are required, the deadline is optional
+  uint32_t values[4] = {};
+  const char *field = comma + 1;
+  for (uint8_t f = 0; f < 4; f++) {
+    char *end;
+    unsigned long value = strtoul(field, &end, 10);
+    bool last = *end != ',';
+    if (end == field || (last && *end != '\0' && *end != '\r' && *end != '\n')) {
+      if (f < 3) return false;
+      break;
+    }
+    values[f] = (uint32_t)value;
+    if (last) {
+      if (f < 2) return false;
+      break;
+    }
+    field = end + 1;
+  }
+
+  size_t nameLength = comma - line;
+  if (nameLength >= nameSize) nameLength = nameSize - 1;
+  memcpy(nameBuffer, line, nameLength);
+  nameBuffer[nameLength] = '\0';
+
+  task.name = nameBuffer;
+  task.priority = (uint8_t)values[0];
+  task.period = values[1];
+  task.wcet = values[2];
+  task.deadline = values[3];
+  task.response = 0;
+  task.schedulable = false;
+  return true;
+}
+
+
+int Sched_FormatHeader(char *buffer, uint32_t size) {
+  return snprintf(buffer, size, "task,priority,period_us,wcet_us,deadline_us,response_us,status");
+}
+
+
+int Sched_FormatTask(const SchedTask &task, char *buffer, uint32_t size) {
+  return snprintf(buffer, size, "%s,%u,%lu,%lu,%lu,%lu,%s", task.name, (unsigned)task.priority,
+                  (unsigned long)task.period, (unsigned long)task.wcet,
+                  (unsigned long)deadlineOf(task), (unsigned long)task.response,
+                  task.schedulable ? "ok" : "MISSED");
+}
+
+
+int Sched_FormatResult(const SchedResult &result, char *buffer, uint32_t size) {
+  return snprintf(buffer, size, "U=%lu.%lu%% (bound %lu.%lu%%), %s",
+                  (unsigned long)(result.utilisation / 10), (unsigned long)(result.utilisation % 10),
+                  (unsigned long)(result.bound / 10), (unsigned long)(result.bound % 10),
+                  result.schedulable ? "schedulable" : "NOT SCHEDULABLE");
+}
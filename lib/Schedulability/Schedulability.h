@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+//Fixed-priority schedulability analysis, shared by the firmware and the host tool
+//Plain C++ with no Arduino or HAL dependencies so it builds on both
+
+//One task or interrupt of the set; a higher priority value preempts a lower one
+//A deadline longer than the period suits queue-fed tasks, which may fall
+//behind by up to a queue's worth of releases without losing anything
+struct SchedTask {
+  const char *name;
+  uint8_t priority;
+  uint32_t period;        //Minimum time between releases (us)
+  uint32_t wcet;          //Worst-case execution time (us)
+  uint32_t deadline;      //Relative deadline (us), 0 for the period
+  uint32_t response;      //Worst-case response time (us), filled in by Sched_Analyse
+  bool schedulable;       //Response time is within the deadline
+};
+
+struct SchedResult {
+  uint32_t utilisation;   //Total utilisation in parts per thousand
+  uint32_t bound;         //Liu & Layland bound for this many tasks, per thousand
+  bool withinBound;       //Utilisation test passed (sufficient, not necessary)
+  bool schedulable;       //Every task meets its deadline by response-time analysis
+};
+
+//Run the utilisation test and the exact response-time analysis on a task set
+//Tasks of equal priority are assumed to delay each other (FreeRTOS round robin)
+SchedResult Sched_Analyse(SchedTask *tasks, uint8_t count);
+
+//Parse one CSV line "name,priority,period_us,wcet_us[,deadline_us,...]" into a task
+//name is copied into nameBuffer; returns false for headers and other lines
+bool Sched_ParseCSV(const char *line, SchedTask &task, char *nameBuffer, uint8_t nameSize);
+
+//Format the report lines so the firmware and the host tool print the same analysis
+//Header and task lines are themselves valid input for Sched_ParseCSV
+int Sched_FormatHeader(char *buffer, uint32_t size);
+int Sched_FormatTask(const SchedTask &task, char *buffer, uint32_t size);
+int Sched_FormatResult(const SchedResult &result, char *buffer, uint32_t size);
@@ -4,6 +4,13 @@
 #include <cmath>
 #include <ES_CAN.h>
 #include <STM32FreeRTOS.h>   // Include FreeRTOS for STM32
+#include <DisplayDMA.h>
+#include <Schedulability.h>
+#include <HostLink.h>
+#include <SVF.h>
+#include <AudioDMA.h>
+#include <Dither.h>
+#include <MidiBridge.h>
 
 
 // Uncomment the following lines for test builds:
@@ -13,7 +20,14 @@
 //#define TEST_DECODE
 //#define TEST_CAN_TX
 //#define TEST_DISPLAYUPDATE
+//#define TEST_TIMESYNC
+//#define TEST_POLYPHONY
+//#define TEST_MIDI
 
+// Uncomment (or build with -D CAN_LOOPBACK) to run a single board with the
+// CAN controller in loopback mode. Loopback ignores the RX pin, so modules
+// cannot hear each other: the handshake falls back to the manual settings.
+//#define CAN_LOOPBACK
 
 
 //#define MEASURE_TASK_TIMES  // Uncomment to enable task/ISR timing measurements
@@ -25,6 +39,7 @@ volatile uint32_t maxDisplayUpdateTime = 0;
 volatile uint32_t maxDecodeTime = 0;
 volatile uint32_t maxCAN_TX_Time = 0;
 volatile uint32_t maxSampleISRTime = 0;
+volatile uint32_t maxEffectsTime = 0;
 
 // Macro to mark start and end of a task section
 #define TASK_START()  uint32_t tStart = micros()
@@ -41,6 +56,38 @@ volatile uint32_t maxSampleISRTime = 0;
 #endif
 
 
+//#define MEASURE_LATENCY  // Uncomment to enable key-to-sound latency histograms
+
+#ifdef MEASURE_LATENCY
+// Stages of the key-to-sound path, each with its own histogram
+enum LatencyStage { LAT_SCAN = 0, LAT_QUEUE, LAT_BUS, LAT_DECODE, LAT_RENDER, LAT_TOTAL, LAT_STAGE_COUNT };
+const char* latencyStageNames[LAT_STAGE_COUNT] = { "scan", "queue", "bus", "decode", "render", "total" };
+
+// Bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us, the last bucket everything above
+const uint8_t LATENCY_BUCKETS = 16;
+
+struct LatencyHistogram {
+    volatile uint32_t buckets[LATENCY_BUCKETS];
+    volatile uint32_t count;
+    volatile uint32_t maxUs;
+};
+
+LatencyHistogram latencyHist[LAT_STAGE_COUNT];
+
+// Add one measurement to a stage histogram (safe to call from ISRs)
+void recordLatency(LatencyStage stage, uint32_t us) {
+    uint8_t bucket = (us == 0) ? 0 : (32 - __builtin_clz(us));
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    LatencyHistogram &h = latencyHist[stage];
+    h.buckets[bucket]++;
+    h.count++;
+    if (us > h.maxUs) h.maxUs = us;
+}
+
+#define LATENCY_RECORD(stage, us)  recordLatency(stage, us)
+#else
+#define LATENCY_RECORD(stage, us)
+#endif
 
 
 enum ModuleRole { SENDER, RECEIVER };
@@ -52,9 +99,24 @@ uint8_t moduleOctave = 4;         // Default octave number (can be changed at ru
 volatile int joyX12Val = 6;  // Default mid value (0 to 12)
 volatile int joyY12Val = 6;  // Default mid value (0 to 12)
 
+// CENTRAL: only the RECEIVER renders audio, for every module's keys.
+// DISTRIBUTED: every module renders its own keys on its own speaker, so total
+// polyphony grows with the number of modules. Note frames still go on the bus
+// (flagged as rendered) so the other modules can display them.
+enum VoiceMode { VOICES_CENTRAL, VOICES_DISTRIBUTED };
+volatile VoiceMode voiceMode = VOICES_CENTRAL;  // Toggled with Knob 3S
+
+// What the display shows, cycled with Knob 2S
+enum DisplayView { VIEW_STATUS = 0, VIEW_SCOPE, VIEW_SPECTRUM, VIEW_COUNT };
+volatile DisplayView displayView = VIEW_STATUS;
+
 enum WaveformType { SAWTOOTH = 0, PIANO, RISE, TRIANGLE, SINE, SQUARE, PULSE, NOISE };
 volatile WaveformType currentWaveform = SAWTOOTH;  // Default waveform
 
+// Master bus effects, cycled with the joystick button
+enum EffectsPreset { FX_OFF = 0, FX_CHORUS, FX_DELAY, FX_REVERB, FX_ALL, FX_PRESET_COUNT };
+volatile EffectsPreset currentEffects = FX_OFF;
+
 //create a sine lookup table
 const int SINE_TABLE_SIZE = 256;
 
@@ -127,6 +189,13 @@ class Knob {
             return __atomic_load_n(&rotation, __ATOMIC_RELAXED);
         }
     
+        // Set the rotation directly (clamped to the limits), e.g. after auto-detection.
+        void setRotation(int value) {
+            if (value < lowerLimit) value = lowerLimit;
+            if (value > upperLimit) value = upperLimit;
+            __atomic_store_n(&rotation, value, __ATOMIC_RELAXED);
+        }
+
         // Set new lower and upper limits, and adjust the current value if needed.
         void setLimits(int lower, int upper) {
             lowerLimit = lower;
@@ -148,33 +217,243 @@ class Knob {
     };
 
 
+// ------------------------- Clock Sync Class -------------------------------- //
+
+// Maps this module's micros() onto the time base of the sync master.
+// The master broadcasts SYNC, then a FOLLOW_UP carrying the time the SYNC
+// frame actually left the bus (PTP two-step). A CAN frame reaches every node
+// at the same instant, so no delay request/response round is needed: each
+// follower steps its offset to the master time and estimates its rate error
+// over a window of several seconds so RX jitter averages out.
+class ClockSync {
+    public:
+        ClockSync() : active(0), anchorLocal(0), anchorMaster(0), prevLocal(0), syncCount(0) {
+            reset();
+        }
+
+        // Identity mapping: synced time equals local time.
+        void reset() {
+            params[0] = params[1] = {0, 0, 0};
+            syncCount = 0;
+        }
+
+        // Convert a local micros() reading to the shared time base (ISR safe)
+        uint32_t toSynced(uint32_t local) const {
+            const Params &p = params[__atomic_load_n(&active, __ATOMIC_ACQUIRE)];
+            int32_t dt = (int32_t)(local - p.refLocal);
+            int32_t correction = (int32_t)(((int64_t)dt * p.driftQ32) >> 32);
+            return p.refSynced + dt + correction;
+        }
+
+        // Apply one sync: local arrival time of SYNC and the master's transmit
+        // time from the matching FOLLOW_UP. Single writer only.
+        void onSync(uint32_t localRx, uint32_t masterTx) {
+            uint8_t next = active ^ 1;
+            Params p = params[active];
+            bool gap = (localRx - prevLocal) >= MAX_SYNC_INTERVAL_US;
+            if (syncCount == 0 || gap) {
+                anchorLocal = localRx;
+                anchorMaster = masterTx;
+                syncCount = 0;
+            }
+            else {
+                // Rate error of the local oscillator in Q32 (master/local - 1),
+                // measured from the start of the current window. A short first
+                // window gives a quick estimate; later ones wait for a longer
+                // baseline so jitter averages out.
+                uint32_t baseline = localRx - anchorLocal;
+                int32_t error = (int32_t)((masterTx - anchorMaster) - baseline);
+                if (syncCount == 1 || baseline >= MIN_DRIFT_BASELINE_US) {
+                    p.driftQ32 = (int32_t)(((int64_t)error << 32) / baseline);
+                }
+                if (baseline >= DRIFT_WINDOW_US) {
+                    anchorLocal = localRx;
+                    anchorMaster = masterTx;
+                }
+            }
+            p.refLocal = localRx;
+            p.refSynced = masterTx;
+            params[next] = p;
+            __atomic_store_n(&active, next, __ATOMIC_RELEASE);
+
+            prevLocal = localRx;
+            if (syncCount < 255) syncCount++;
+        }
+
+        bool isLocked() const { return syncCount >= 2; }
+
+        // Current rate correction in parts per million
+        int32_t getDriftPpm() const {
+            return (int32_t)(((int64_t)params[active].driftQ32 * 1000000) >> 32);
+        }
+
+    private:
+        struct Params {
+            uint32_t refLocal;   // Local time of the last sync
+            uint32_t refSynced;  // Master time of the last sync
+            int32_t driftQ32;    // Rate error, scaled by 2^32
+        };
+
+        // Syncs further apart than this are treated as a fresh start
+        static const uint32_t MAX_SYNC_INTERVAL_US = 2000000;
+        // Rate is re-measured over windows of this length (tracks slow drift)
+        static const uint32_t DRIFT_WINDOW_US = 10000000;
+        static const uint32_t MIN_DRIFT_BASELINE_US = 1000000;
+
+        // Double buffered so ISR readers never see a half-written update
+        Params params[2];
+        volatile uint8_t active;
+
+        uint32_t anchorLocal;   // Start of the current drift window
+        uint32_t anchorMaster;
+        uint32_t prevLocal;
+        uint8_t syncCount;
+    };
+
+ClockSync clockSync;
+
+
+// ------------------------- Seqlock Class ----------------------------------- //
+
+// Versioned, double-buffered value with one writer and any number of readers.
+// The writer fills the inactive copy and then bumps the sequence number, so a
+// reader never waits on a lock: it copies the active buffer and retries only
+// if a publish finished while it was copying. An ISR cannot be preempted by
+// the writer, so its single tryRead() always succeeds.
+template <typename T>
+class Seqlock {
+    public:
+        Seqlock() : seq(0) {
+            buffers[0] = T();
+            buffers[1] = T();
+        }
+
+        // Only ever call from the one owning context
+        void write(const T &value) {
+            uint32_t next = seq + 1;
+            buffers[next & 1] = value;
+            __atomic_store_n(&seq, next, __ATOMIC_RELEASE);
+        }
+
+        // Copy the latest value; false if it changed under us (out is then
+        // unspecified and the caller should keep its previous copy)
+        bool tryRead(T &out) const {
+            uint32_t start = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+            out = buffers[start & 1];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return __atomic_load_n(&seq, __ATOMIC_RELAXED) == start;
+        }
+
+        // Task readers: retry until a clean copy is made
+        T read() const {
+            T out;
+            while (!tryRead(out));
+            return out;
+        }
+
+        uint32_t version() const { return __atomic_load_n(&seq, __ATOMIC_ACQUIRE); }
+
+    private:
+        T buffers[2];
+        uint32_t seq;
+    };
+
+
 // ------------------------ GLOBAL STRUCT & GLOBALS ------------------------ //
 
 // Shared system state (used by more than one thread)
 struct {
-    std::bitset<32> inputs;
-    SemaphoreHandle_t mutex;  
     int knob3Rotation;
     Knob knob3;
     Knob knob2;
     Knob knob1;
     Knob knob0;
-    uint8_t RX_Message[8];
     bool eastDetected;
     bool westDetected;
     } sysState;
 
+// Controls owned by scanKeysTask. moduleRole, voiceMode, currentWaveform and
+// moduleOctave are its working copies; every other task and the ISR reads
+// them from this snapshot so they always see one consistent set.
+struct ControlSnapshot {
+    std::bitset<32> inputs;
+    ModuleRole role;
+    VoiceMode voiceMode;
+    WaveformType waveform;
+    EffectsPreset effects;
+    uint8_t octave;
+};
+Seqlock<ControlSnapshot> controlState;
+std::bitset<32> scannedInputs;  // Last key matrix scan (scanKeysTask only)
+
+// Last note frame handled by decodeTask, shown on the display
+struct RXMessage {
+    uint8_t data[8];
+};
+Seqlock<RXMessage> lastRXMessage;
 
-// Global variable for the current note step size (accessed by ISR)
-uint32_t currentStepSize = 0;
 
 // Phase accumulator for audio generation
 static uint32_t phaseAcc = 0;
-HardwareTimer sampleTimer(TIM1);
 
-volatile uint8_t TX_Message[8] = {0}; 
+volatile uint8_t TX_Message[8] = {0};
+
+// CAN IDs used between modules
+const uint32_t CAN_ID_NOTE = 0x123;
+const uint32_t CAN_ID_SYNC = 0x124;       // [0] 'S', [1] sequence number
+const uint32_t CAN_ID_FOLLOW_UP = 0x125;  // [0] 'F', [1] sequence, [4..7] master TX time (us)
+const uint32_t CAN_ID_HANDSHAKE = 0x126;  // [0] 'H'/'C'/'A', [1] position or module count, [4..7] module ID
+
+// Receive filters: bank 0 takes the control frames (0x124-0x127) every role
+// needs, bank 1 takes note frames and is only enabled on the RECEIVER.
+const uint32_t CAN_CONTROL_MASK = 0x7FC;
+const uint32_t CAN_NOTE_MASK = 0x7FF;
+
+const uint32_t SYNC_PERIOD_MS = 100;
+const uint32_t SYNC_TX_TIMEOUT_MS = 5;   // Longest wait for a SYNC to be sent
+
+// Note frame layout (CAN ID 0x123):
+//   [0] 'P' (press), 'R' (release) or 'A' (key pressure), [1] octave, [2] key,
+//   [3] flags (FRAME_FLAG_*) and, in bits 1-7, the velocity of a press or the
+//   pressure value (0 on a press means the default velocity),
+//   [4] time spent in the sender's msgOutQ (units of 32 us, saturating),
+//   [5..7] 24-bit send timestamp in us from syncedMicros()
+const uint8_t FRAME_FLAGS = 3;
+const uint8_t FRAME_QUEUE_DELAY = 4;
+const uint8_t FRAME_FLAG_RENDERED = 0x01;  // Sender already plays this note itself
+const uint8_t FRAME_VALUE_SHIFT = 1;
+const uint8_t FRAME_STAMP = 5;
+const uint32_t STAMP_MASK = 0xFFFFFF;
+
+// Received frame with its arrival time, as passed from CAN_RX_ISR to decodeTask
+struct CANFrame {
+    uint32_t id;
+    uint32_t rxTime;
+    uint8_t data[8];
+};
 
 QueueHandle_t msgInQ;
+QueueHandle_t handshakeQ;
+
+// Role manager and the transmit task it starts and stops
+TaskHandle_t roleManagerHandle = NULL;
+TaskHandle_t CAN_TX_Handle = NULL;
+SemaphoreHandle_t txStoppedSemaphore;
+
+// Display task, woken by change events posted as task notification bits.
+// The first six bits follow the order of UIField.
+TaskHandle_t displayUpdateHandle = NULL;
+const uint32_t UI_EVT_ROLE     = 1 << 0;   // Role or voice mode
+const uint32_t UI_EVT_JOYSTICK = 1 << 1;
+const uint32_t UI_EVT_WAVEFORM = 1 << 2;
+const uint32_t UI_EVT_OCTAVE   = 1 << 3;
+const uint32_t UI_EVT_VOLUME   = 1 << 4;
+const uint32_t UI_EVT_RX       = 1 << 5;   // New last received message
+const uint32_t UI_EVT_FIELDS   = 0x3F;
+const uint32_t UI_EVT_VIEW     = 1 << 6;   // Knob 2S view change
+const uint32_t UI_EVT_ANALYSIS = 1 << 7;   // New scope/spectrum frame
+const uint32_t UI_EVT_DMA_DONE = 1 << 8;   // Previous frame fully sent
+const uint32_t UI_EVT_REDRAW   = 1 << 9;   // Redraw everything
 #ifdef TEST_SCANKEYS
   // Increase the queue size in test mode to avoid blocking.
   QueueHandle_t msgOutQ;  // We’ll create a larger queue below.
@@ -184,9 +463,36 @@ QueueHandle_t msgInQ;
 
 SemaphoreHandle_t CAN_TX_Semaphore;
 
+// The SYNC frame being timed: the mailbox it was loaded into (0 once sent or
+// abandoned) and the local micros() when its transmission completed
+volatile uint32_t syncTxMailbox = 0;
+volatile uint32_t syncTxTime = 0;
+TaskHandle_t timeSyncHandle = NULL;
+
 // ------------------------- CONSTANTS & PIN DEFINITIONS ------------------------ //
 
-constexpr uint32_t SAMPLE_RATE = 22050; // Audio sample rate (Hz)
+// Supported audio sample rates (Hz). DEFAULT_SAMPLE_RATE picks one at build
+// time (-D DEFAULT_SAMPLE_RATE=44100); holding key C, C#, D or D# while the
+// module powers up selects the first, second, third or fourth for that boot.
+constexpr uint32_t SAMPLE_RATES[] = { 16000, 22050, 44100, 48000 };
+constexpr uint8_t SAMPLE_RATE_COUNT = sizeof(SAMPLE_RATES) / sizeof(SAMPLE_RATES[0]);
+#ifndef DEFAULT_SAMPLE_RATE
+#define DEFAULT_SAMPLE_RATE 22050
+#endif
+
+constexpr uint8_t sampleRateIndex(uint32_t rate, uint8_t i = 0) {
+    return (i == SAMPLE_RATE_COUNT || SAMPLE_RATES[i] == rate) ? i : sampleRateIndex(rate, i + 1);
+}
+constexpr uint8_t DEFAULT_SAMPLE_RATE_INDEX = sampleRateIndex(DEFAULT_SAMPLE_RATE);
+static_assert(DEFAULT_SAMPLE_RATE_INDEX < SAMPLE_RATE_COUNT, "DEFAULT_SAMPLE_RATE must be one of SAMPLE_RATES");
+
+// Fixed once setup() has picked the rate
+uint32_t sampleRate = DEFAULT_SAMPLE_RATE;
+float samplePeriod = 1.0f / DEFAULT_SAMPLE_RATE;  // Seconds per sample, for the envelopes
+const uint32_t SCAN_PERIOD_MS = 20;     // Key matrix scan period
+// Shortest time between CAN frames: an 8-byte standard frame plus interframe
+// space is 111 bits before stuffing, at 125 kbit/s
+const uint32_t CAN_FRAME_US = 888;
 
 //Pin definitions
   //Row select and enable
@@ -202,7 +508,7 @@ constexpr uint32_t SAMPLE_RATE = 22050; // Audio sample rate (Hz)
   const int C3_PIN = D1;
   const int OUT_PIN = D11;
 
-  //Audio analogue out
+  //Audio analogue out, driven by lib/AudioDMA (DAC channel 2 and 1)
   const int OUTL_PIN = A4;
   const int OUTR_PIN = A3;
 
@@ -222,31 +528,110 @@ constexpr uint32_t SAMPLE_RATE = 22050; // Audio sample rate (Hz)
   #define LED_BUILTIN PC13   // Change to the correct LED pin for your board
 #endif
 
-// Display driver instance
-U8G2_SSD1305_128X32_ADAFRUIT_F_HW_I2C u8g2(U8G2_R0);
+// Display driver instance (I2C transfers are queued to DMA, see lib/DisplayDMA)
+U8G2_SSD1305_128X32_ADAFRUIT_F_DMA_I2C u8g2(U8G2_R0);
 
 // -------------------------- NOTE CALCULATION ------------------------------- //
 
-// Calculate the phase step size for a given frequency
-constexpr uint32_t calculateStepSize(float frequency) {
-    return static_cast<uint32_t>((pow(2, 32) * frequency) / SAMPLE_RATE);
-}
-
-// Step sizes for the 12 semitones (C to B)
-const uint32_t stepSizes[12] = {
-    calculateStepSize(261.63f),  // C
-    calculateStepSize(277.18f),  // C#
-    calculateStepSize(293.66f),  // D
-    calculateStepSize(311.13f),  // D#
-    calculateStepSize(329.63f),  // E
-    calculateStepSize(349.23f),  // F
-    calculateStepSize(369.99f),  // F#
-    calculateStepSize(392.00f),  // G
-    calculateStepSize(415.30f),  // G#
-    calculateStepSize(440.00f),  // A
-    calculateStepSize(466.16f),  // A#
-    calculateStepSize(493.88f)   // B
+// Notes are MIDI note numbers: key k (0 = C) of octave o is (o + 1) * 12 + k,
+// so C4 is 60 and A4 (440 Hz) is 69.
+const uint8_t MIDI_NOTE_COUNT = 128;
+const uint8_t NO_NOTE = 0xFF;
+
+inline uint8_t midiNote(uint8_t octave, uint8_t key) {
+    return (octave + 1) * 12 + key;
+}
+
+// 2^(k/12) for the semitones above A
+constexpr double SEMITONE_RATIOS[12] = {
+    1.0, 1.0594630943592953, 1.122462048309373, 1.189207115002721,
+    1.2599210498948732, 1.3348398541700344, 1.4142135623730951, 1.4983070768766815,
+    1.5874010519681994, 1.681792830507429, 1.7817974362806785, 1.8877486253633868
+};
+
+// Equal-tempered frequency of a MIDI note; octaves are exact powers of two
+constexpr double midiFrequency(int note) {
+    int fromA = note - 69 + 120;  // Kept positive for / and %
+    double frequency = 440.0 * SEMITONE_RATIOS[fromA % 12];
+    for (int octave = fromA / 12 - 10; octave > 0; octave--) frequency *= 2;
+    for (int octave = fromA / 12 - 10; octave < 0; octave++) frequency /= 2;
+    return frequency;
+}
+
+// Calculate the phase step size for a given frequency and sample rate
+constexpr uint32_t calculateStepSize(double frequency, uint32_t rate) {
+    return static_cast<uint32_t>((4294967296.0 * frequency) / rate);
+}
+
+// Phase step of every MIDI note at one sample rate
+struct MidiStepTable {
+    uint32_t step[MIDI_NOTE_COUNT];
+    constexpr MidiStepTable(uint32_t rate) : step() {
+        for (int note = 0; note < MIDI_NOTE_COUNT; note++) {
+            step[note] = calculateStepSize(midiFrequency(note), rate);
+        }
+    }
+};
+
+// Step tables for every supported rate, computed by the compiler
+static_assert(SAMPLE_RATE_COUNT == 4, "Add a MidiStepTable for each sample rate");
+constexpr MidiStepTable midiStepTables[SAMPLE_RATE_COUNT] = {
+    MidiStepTable(SAMPLE_RATES[0]),
+    MidiStepTable(SAMPLE_RATES[1]),
+    MidiStepTable(SAMPLE_RATES[2]),
+    MidiStepTable(SAMPLE_RATES[3]),
+};
+static_assert(midiStepTables[1].step[69] == 85704562, "A4 at 22050 Hz");
+
+// Table for the selected rate
+const uint32_t* midiSteps = midiStepTables[DEFAULT_SAMPLE_RATE_INDEX].step;
+
+// Local key played by the mono voice (scanKeysTask), NO_NOTE when none
+volatile uint8_t currentNote = NO_NOTE;
+
+// Phase step of a note, clamped to the MIDI range
+inline uint32_t noteStep(int note) {
+    if (note < 0) note = 0;
+    if (note >= MIDI_NOTE_COUNT) note = MIDI_NOTE_COUNT - 1;
+    return midiSteps[note];
+}
+
+// 2^(c / 1200) for 0-99 cents, from the series for e^x (x < 0.06)
+constexpr double centRatio(int cents) {
+    double x = cents / 1200.0 * 0.6931471805599453;
+    double term = 1.0, sum = 1.0;
+    for (int n = 1; n < 10; n++) {
+        term *= x / n;
+        sum += term;
+    }
+    return sum;
+}
+
+struct CentTable {
+    uint32_t q16[100];
+    constexpr CentTable() : q16() {
+        for (int cents = 0; cents < 100; cents++) {
+            q16[cents] = static_cast<uint32_t>(centRatio(cents) * 65536.0 + 0.5);
+        }
+    }
 };
+constexpr CentTable centRatios;
+static_assert(centRatios.q16[50] == 67456, "Quarter tone");
+
+// Apply a Q16 fine-tune ratio to a phase step
+inline uint32_t fineTune(uint32_t step, uint32_t ratioQ16) {
+    return (uint32_t)(((uint64_t)step * ratioQ16) >> 16);
+}
+
+// Phase step of a note detuned by cents: whole semitones from the step
+// table, the rest as a fine-tune ratio
+inline uint32_t pitchStep(int note, int32_t cents) {
+    if (cents == 0) return noteStep(note);
+    if (cents < -9600) cents = -9600;
+    if (cents > 9600) cents = 9600;
+    int32_t semitones = (cents + 12800) / 100 - 128;  // Rounds down
+    return fineTune(noteStep(note + semitones), centRatios.q16[cents - semitones * 100]);
+}
 
 const char* noteNames[12] = {
     "C", "C#", "D", "D#", "E", "F",
@@ -254,11 +639,20 @@ const char* noteNames[12] = {
 };
 
 
-// Compute the sample based on the phase accumulator and current waveform
-int computeWaveform(uint32_t phase) {
+// Noise generator shared by the noise waveform and the sample-and-hold LFO
+// (audio ISR only)
+uint32_t noiseSeed = 0x12345678;
+
+inline uint32_t nextNoise() {
+    noiseSeed = noiseSeed * 1664525UL + 1013904223UL;
+    return noiseSeed;
+}
+
+// Compute the sample based on the phase accumulator and waveform
+int computeWaveform(uint32_t phase, WaveformType waveform, uint8_t pulseWidth = 128) {
     uint8_t x = phase >> 24;  // Use the top 8 bits (0-255) as our phase index
     int sample = 0;
-    switch(currentWaveform) {
+    switch(waveform) {
         case SAWTOOTH:
             // Linear ramp from -128 to +127.
             sample = (int)x - 128;
@@ -283,21 +677,16 @@ int computeWaveform(uint32_t phase) {
             break;
         case PULSE:
             {
-                // Pulse wave: like square but with an adjustable duty cycle.
-                // Let's use knob3 as the duty cycle control (range 0 to 8).
-                int duty = sysState.knob3.getRotation(); // 0 (short pulse) to 8 (long pulse)
-                // Map duty (0-8) to a threshold value in the range 0-255.
-                int threshold = (duty * 256) / 9;  
-                sample = (x < threshold) ? 127 : -127;
+                // Pulse wave: like square but with the high part lasting
+                // pulseWidth / 256 of the cycle (set by the modulation matrix).
+                sample = (x < pulseWidth) ? 127 : -127;
             }
             break;
         case NOISE:
             {
-                // Generate pseudo-random noise. This simple LCG uses a static seed.
-                static uint32_t noiseSeed = 0x12345678;
-                noiseSeed = noiseSeed * 1664525UL + 1013904223UL;
+                // Generate pseudo-random noise from the shared LCG.
                 // Use the lower 8 bits and center the output.
-                sample = (int)(noiseSeed & 0xFF) - 128;
+                sample = (int)(nextNoise() & 0xFF) - 128;
             }
             break;
         
@@ -312,17 +701,87 @@ int computeWaveform(uint32_t phase) {
 
 // --------------------------- HELPER FUNCTIONS ------------------------------ //
 
+// Time base shared by every module for frame timestamps (us).
+// Follows the sync master once clockSync has locked; safe to call from ISRs.
+uint32_t syncedMicros() {
+    return clockSync.toSynced(micros());
+}
+
+// Write the 24-bit timestamp into a note frame
+void stampFrame(uint8_t msg[8], uint32_t time) {
+    msg[FRAME_STAMP]     = time & 0xFF;
+    msg[FRAME_STAMP + 1] = (time >> 8) & 0xFF;
+    msg[FRAME_STAMP + 2] = (time >> 16) & 0xFF;
+}
+
+// Read the 24-bit timestamp back from a note frame
+uint32_t frameStamp(const uint8_t msg[8]) {
+    return msg[FRAME_STAMP] | (msg[FRAME_STAMP + 1] << 8) | ((uint32_t)msg[FRAME_STAMP + 2] << 16);
+}
+
+// Microseconds elapsed between a frame's timestamp and a later time
+uint32_t stampAge(const uint8_t msg[8], uint32_t now) {
+    return (now - frameStamp(msg)) & STAMP_MASK;
+}
+
+// Send a frame from any task. Taking CAN_TX_Semaphore reserves a mailbox;
+// the critical section stops two tasks driving the CAN HAL at once. If
+// mailbox is not NULL it is set to the mailbox used before the TX interrupt
+// can run. Returns false if no mailbox became free within the timeout.
+bool sendCANFrame(uint32_t id, uint8_t data[8], TickType_t timeout = portMAX_DELAY,
+                  volatile uint32_t* mailbox = NULL) {
+    if (xSemaphoreTake(CAN_TX_Semaphore, timeout) != pdTRUE) return false;
+    taskENTER_CRITICAL();
+    uint32_t used;
+    CAN_TX(id, data, &used);
+    if (mailbox) *mailbox = used;
+    taskEXIT_CRITICAL();
+    return true;
+}
+
+// Tell the display task what changed
+void notifyUI(uint32_t events) {
+    if (displayUpdateHandle != NULL) {
+        xTaskNotify(displayUpdateHandle, events, eSetBits);
+    }
+}
+
+// Publish the working control variables. Only scanKeysTask (and setup()
+// before the scheduler starts) may call this.
+void publishControls() {
+    ControlSnapshot snapshot;
+    snapshot.inputs = scannedInputs;
+    snapshot.role = moduleRole;
+    snapshot.voiceMode = voiceMode;
+    snapshot.waveform = currentWaveform;
+    snapshot.effects = currentEffects;
+    snapshot.octave = moduleOctave;
+    controlState.write(snapshot);
+}
+
+// Ask the role manager to bring the TX/render pipelines in line with the
+// published role and voice mode. Cheap; safe to call from any task.
+void requestRoleUpdate() {
+    if (roleManagerHandle != NULL) xTaskNotifyGive(roleManagerHandle);
+}
+
+// Values latched into the output DFFs whenever their row is selected
+// (display enable/reset and the west/east handshake outputs)
+bool outBits[8] = { LOW, LOW, LOW, HIGH, HIGH, HIGH, HIGH, LOW };
+
 // Set the row lines on the 3-to-8 decoder based on a row number
 void setRow(uint8_t row) {
     digitalWrite(REN_PIN, LOW);
     digitalWrite(RA0_PIN, (row & 0x01) ? HIGH : LOW);
     digitalWrite(RA1_PIN, (row & 0x02) ? HIGH : LOW);
     digitalWrite(RA2_PIN, (row & 0x04) ? HIGH : LOW);
+    digitalWrite(OUT_PIN, outBits[row]);  // Re-latched on the row's rising edge
     delayMicroseconds(2);
     digitalWrite(REN_PIN, HIGH);
 }
 
 void setOutMuxBit(const uint8_t bitIdx, const bool value) {
+    outBits[bitIdx] = value;
     digitalWrite(REN_PIN,LOW);
     digitalWrite(RA0_PIN, bitIdx & 0x01);
     digitalWrite(RA1_PIN, bitIdx & 0x02);
@@ -345,24 +804,578 @@ std::bitset<4> readCols() {
 
 
     
+// Modulation state of one voice, updated every control block
+struct VoiceMod {
+    int32_t pitch;       // Cents
+    int32_t pulseWidth;  // 1/256 of a cycle
+    int32_t cutoff;      // Cents
+    int32_t resonance;   // Q15
+    int32_t gain;        // Q15, ramped by gainStep every sample
+    int32_t gainStep;
+    int16_t panLeft;     // Q15 channel gains from the voice's pan position
+    int16_t panRight;
+    bool ready;          // False until the first block sets the values
+};
+
+// Where new voices sit in the stereo field: spread across it by pitch (low
+// notes left, like a piano), by the octave of the module that sent them (so
+// stacked modules sit side by side), or at random
+enum PanMode : uint8_t { PAN_KEY, PAN_MODULE, PAN_RANDOM, PAN_MODE_COUNT };
+volatile PanMode panMode = PAN_KEY;
+const uint8_t PAN_RIGHT = 64;    // Positions run 0 (left) to PAN_RIGHT
+const uint8_t PAN_CENTRE = PAN_RIGHT / 2;
+const uint8_t PAN_SPREAD = 24;   // Voices stay within PAN_CENTRE +- PAN_SPREAD
+
+uint8_t panPosition(uint8_t note, uint8_t octave) {
+    int32_t offset;
+    switch (panMode) {
+        case PAN_MODULE:
+            offset = (octave - 4) * 12;
+            break;
+        case PAN_RANDOM:
+            offset = (int32_t)(((micros() + note) * 0x9E3779B9u) >> 24) % (2 * PAN_SPREAD + 1) - PAN_SPREAD;
+            break;
+        default:
+            offset = (note - 60) * PAN_SPREAD / 36;  // C1 to C7 across the spread
+            break;
+    }
+    if (offset < -PAN_SPREAD) offset = -PAN_SPREAD;
+    if (offset > PAN_SPREAD) offset = PAN_SPREAD;
+    return PAN_CENTRE + offset;
+}
+
+// Output quantiser for the 12-bit DAC (lib/Dither). TPDF dither turns the
+// rounding error of quiet signals into a steady hiss instead of distortion
+// that follows the note; the shaped mode also pushes that hiss up towards
+// half the sample rate, which leaves less of it below fs / 8 than plain
+// rounding (tools/dac_snr.cpp). Set over the host link.
+volatile DitherMode ditherMode = DITHER_SHAPED;
+Dither outputDither[2] = { { 0x6A09E667, 0 }, { 0xBB67AE85, 0 } };  // Left, right (audio ISR only)
+
 struct ActiveNote {
-    uint32_t stepSize;
+    uint32_t step;      // Phase step, re-resolved every control block
     uint32_t phaseAcc;
     uint32_t elapsed;
+    uint8_t note;       // MIDI note (sender's key and octave)
+    uint8_t velocity;   // 1-127
+    uint8_t pressure;   // Polyphonic key pressure, 0-127
+    uint8_t pan;        // Stereo position, 0 (left) to PAN_RIGHT
+    VoiceMod mod;
+    SVF filter;
+#ifdef MEASURE_LATENCY
+    uint32_t latencyOrigin;  // Sender timestamp of the press frame (synced us)
+    uint32_t decodedAt;      // Time decodeTask added the note (synced us)
+    bool latencyPending;     // First sample not rendered yet
+#endif
 };
 
+#ifdef MEASURE_LATENCY
+// Called by the audio ISR for every rendered voice; records render and total
+// latency the first time a newly pressed note produces a sample.
+inline void noteRendered(ActiveNote &note) {
+    if (note.latencyPending) {
+        uint32_t now = syncedMicros();
+        note.latencyPending = false;
+        recordLatency(LAT_RENDER, now - note.decodedAt);
+        recordLatency(LAT_TOTAL, (now - note.latencyOrigin) & STAMP_MASK);
+    }
+}
+#define LATENCY_NOTE_RENDERED(note)  noteRendered(note)
+#else
+#define LATENCY_NOTE_RENDERED(note)
+#endif
+
 #define MAX_POLYPHONY 12  // Maximum number of simultaneous notes
 
 ActiveNote activeNotes[MAX_POLYPHONY];
 uint8_t activeNoteCount = 0;
 
 
+// --------------------------- LOGGING --------------------------------------- //
+
+// Tasks never call Serial directly on their hot paths: a blocking print at
+// 9600 baud held scanKeys for tens of ms. logEvent() stores a small binary
+// record in a ring instead, and the logger task formats and drains it only
+// as fast as the UART TX buffer takes it. When the ring is full the record is
+// dropped and counted, so logging can never stall the producer.
+#define LOG_RING_SIZE 32  // Power of two
+
+enum LogEvent : uint8_t {
+    LOG_TRANSPOSE,          // arg0: +1 up, -1 down
+    LOG_VIEW,               // arg0: DisplayView
+    LOG_VOICE_MODE,         // arg0: VoiceMode
+    LOG_EFFECTS,            // arg0: EffectsPreset
+    LOG_WAVEFORM,           // arg0: WaveformType
+    LOG_ROLE,               // arg0: ModuleRole
+    LOG_HANDSHAKE_DONE,     // arg0: position, arg1: module count, arg2: octave
+    LOG_HANDSHAKE_TIMEOUT,
+};
+
+struct LogEntry {
+    uint8_t event;
+    int16_t args[3];
+};
+
+LogEntry logRing[LOG_RING_SIZE];
+volatile uint32_t logHead = 0;     // Written by producers
+volatile uint32_t logTail = 0;     // Written by the logger task
+volatile uint32_t logDropped = 0;
+TaskHandle_t loggerHandle = NULL;
+
+// Queue a log record; never blocks. Tasks only (uses a task critical section).
+void logEvent(LogEvent event, int16_t arg0 = 0, int16_t arg1 = 0, int16_t arg2 = 0) {
+    taskENTER_CRITICAL();
+    if (logHead - logTail >= LOG_RING_SIZE) {
+        logDropped++;
+    } else {
+        LogEntry &entry = logRing[logHead & (LOG_RING_SIZE - 1)];
+        entry.event = event;
+        entry.args[0] = arg0;
+        entry.args[1] = arg1;
+        entry.args[2] = arg2;
+        logHead++;
+    }
+    taskEXIT_CRITICAL();
+    if (loggerHandle != NULL) xTaskNotifyGive(loggerHandle);
+}
+
+
+// --------------------------- POWER MANAGER --------------------------------- //
+
+// The sample clock only runs while something can sound. The audio ISR stops it
+// after AUDIO_IDLE_MS of silence (no active notes and no local key held), and
+// audioWake() restarts it from the key scan or the decoder, so a new note
+// starts within one scan period (keys) or one decode (CAN) plus one sample.
+// With the timer stopped the CPU sleeps between task wake-ups, and FreeRTOS
+// tickless idle (configUSE_TICKLESS_IDLE, platformio.ini) drops the tick
+// interrupts in between.
+const uint32_t AUDIO_IDLE_MS = 200;
+uint32_t audioIdleSamples = DEFAULT_SAMPLE_RATE * AUDIO_IDLE_MS / 1000;
+const uint32_t FX_TAIL_MS = 2500;  // Effect tails (delay echoes fall 60 dB in ~2.2 s)
+uint32_t fxTailSamples = DEFAULT_SAMPLE_RATE * FX_TAIL_MS / 1000;
+
+volatile bool renderEnabled = true;   // The role renders audio (role manager)
+volatile bool audioRunning = true;    // The sample timer is running
+volatile uint32_t silentSamples = 0;
+
+// Wake-up latency: from the restart request to the first sample (us)
+volatile uint32_t audioWakeRequestedAt = 0;
+volatile bool audioWakePending = false;
+volatile uint32_t lastAudioWakeLatency = 0;
+volatile uint32_t maxAudioWakeLatency = 0;
+volatile uint32_t audioWakeCount = 0;
+volatile uint32_t audioPausedAt = 0;       // millis() when the timer stopped
+volatile uint32_t audioPausedTotalMs = 0;  // Completed pauses
+
+// Both are called with the sample interrupt masked (critical section or the ISR itself)
+void stopSampleTimer() {
+    AudioDMA_Stop();  // Park both outputs at mid-scale
+    audioRunning = false;
+    audioPausedAt = millis();
+}
+
+void startSampleTimer() {
+    silentSamples = 0;
+    audioPausedTotalMs += millis() - audioPausedAt;
+    audioWakeRequestedAt = micros();
+    audioWakePending = true;
+    audioRunning = true;
+    AudioDMA_Start();
+}
+
+// A note is about to sound: restart the sample timer if it is idle (tasks only)
+void audioWake() {
+    taskENTER_CRITICAL();
+    silentSamples = 0;
+    if (renderEnabled && !audioRunning) {
+        startSampleTimer();
+        audioWakeCount++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+// Milliseconds spent with the sample timer stopped since boot
+uint32_t audioPausedMs() {
+    taskENTER_CRITICAL();
+    uint32_t total = audioPausedTotalMs;
+    if (!audioRunning) total += millis() - audioPausedAt;
+    taskEXIT_CRITICAL();
+    return total;
+}
+
+#if configUSE_TICKLESS_IDLE == 1
+// Tickless idle stops SysTick while the CPU sleeps, which would leave the HAL
+// millisecond count (millis(), micros(), HAL timeouts) behind. Once the
+// scheduler runs it follows the FreeRTOS tick, which the port steps forward
+// by the time slept.
+uint32_t halTickOffset = 0;
+
+extern "C" uint32_t HAL_GetTick(void) {
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) return uwTick;
+    return xTaskGetTickCount() + halTickOffset;
+}
+#endif
+
+
+// --------------------------- SAMPLE RATE ----------------------------------- //
+
+// Switch the synthesis to one of SAMPLE_RATES; call before the timer starts
+void applySampleRate(uint8_t index) {
+    sampleRate = SAMPLE_RATES[index];
+    samplePeriod = 1.0f / sampleRate;
+    midiSteps = midiStepTables[index].step;
+    audioIdleSamples = sampleRate * AUDIO_IDLE_MS / 1000;
+    fxTailSamples = sampleRate * FX_TAIL_MS / 1000;
+}
+
+// Use the build-time default unless one of the first four keys (row 0) is
+// held at power-up
+void selectSampleRate() {
+    uint8_t index = DEFAULT_SAMPLE_RATE_INDEX;
+    setRow(0);
+    delayMicroseconds(3);
+    std::bitset<4> cols = readCols();
+    for (uint8_t i = 0; i < SAMPLE_RATE_COUNT && i < 4; i++) {
+        if (!cols[i]) {
+            index = i;
+            break;
+        }
+    }
+    applySampleRate(index);
+    Serial.print("Sample rate: ");
+    Serial.print(sampleRate);
+    Serial.println(" Hz");
+}
+
+
+// --------------------------- MIDI BRIDGE ----------------------------------- //
+
+// MIDI note events arrive as USB-MIDI event packets through lib/MidiBridge,
+// which also holds the ring of mirrored local key events. The L432KC's only
+// USB pins (PA11/PA12) carry CAN on this board, so no USB device is started;
+// the host link hands packets to MidiBridge_Receive().
+
+// Feed an external note event ('P', 'R' or 'A' with its velocity or
+// pressure) through the same path as a local key: rendered via decodeTask
+// when this module plays notes, forwarded on CAN when it sends.
+void injectNote(char type, uint8_t octave, uint8_t key, uint8_t value) {
+    uint8_t msg[8] = {0};
+    msg[0] = type;
+    msg[1] = octave;
+    msg[2] = key;
+    msg[FRAME_FLAGS] = (value & 0x7F) << FRAME_VALUE_SHIFT;
+    stampFrame(msg, syncedMicros());
+    ControlSnapshot controls = controlState.read();
+    if (controls.role == RECEIVER || controls.voiceMode == VOICES_DISTRIBUTED) {
+        CANFrame local = { CAN_ID_NOTE, micros(), {0} };
+        memcpy(local.data, msg, 8);
+        xQueueSend(msgInQ, &local, 0);
+        msg[FRAME_FLAGS] |= FRAME_FLAG_RENDERED;
+    }
+    if (controls.role == SENDER) xQueueSend(msgOutQ, msg, 0);
+}
+
+
+// --------------------------- HOST LINK ------------------------------------- //
+
+// Binary protocol on the ST-Link virtual COM port (lib/HostLink). Received
+// bytes land in a DMA ring and frames are parsed where they lie; only the
+// fields a handler needs are read out. Frames sent to the host share the line
+// with the log text, so every Serial writer holds serialMutex for whole
+// writes. tools/host_link replays performances and measures the link.
+#define HOST_BAUD 1000000  // 80 MHz / 80, no baud rate error
+const TickType_t HOST_POLL_ACTIVE_MS = 1;
+const TickType_t HOST_POLL_IDLE_MS = 20;   // Until the first frame from a host
+const uint32_t HOST_ACTIVE_MS = 1000;      // Host traffic keeps the fast poll this long
+const uint32_t HOST_TELEMETRY_MS = 100;
+
+TaskHandle_t hostLinkHandle = NULL;
+SemaphoreHandle_t serialMutex;
+volatile uint32_t hostRxFrames = 0;
+volatile uint32_t hostRxErrors = 0;
+volatile uint32_t hostTxDropped = 0;
+
+// Called from the DMA interrupt each time half of the receive ring fills
+void hostRxISR() {
+    BaseType_t woken = pdFALSE;
+    if (hostLinkHandle != NULL) vTaskNotifyGiveFromISR(hostLinkHandle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Send one frame if the UART has room for all of it; never blocks on the line.
+// Nor does it wait for another writer (the debug monitor holds the mutex for
+// its whole report): a frame that cannot go at once is dropped and counted,
+// so hostLinkTask keeps draining the receive ring.
+bool hostSend(uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[HOST_MAX_FRAME];
+    uint32_t size = HostProto_Encode(type, payload, length, frame);
+    bool sent = false;
+    if (xSemaphoreTake(serialMutex, 0) == pdTRUE) {
+        if (Serial.availableForWrite() >= (int)size) {
+            Serial.write(frame, size);
+            sent = true;
+        }
+        xSemaphoreGive(serialMutex);
+    }
+    if (!sent) hostTxDropped++;
+    return sent;
+}
+
+void handleHostFrame(const volatile uint8_t* ring, const HostFrame &frame) {
+    switch (frame.type) {
+        case HOST_MIDI:
+            if (frame.length == 4) {
+                uint8_t packet[4];
+                for (uint8_t i = 0; i < 4; i++) packet[i] = ring[(frame.payload + i) & HOST_RX_MASK];
+                MidiBridge_Receive(packet);
+            }
+            break;
+        case HOST_PARAM:
+            if (frame.length == 3) {
+                uint8_t param = ring[frame.payload & HOST_RX_MASK];
+                int16_t value = HostProto_Get16(ring, HOST_RX_MASK, frame.payload + 1);
+                Knob* knobs[HOST_PARAM_PAN_MODE] = { &sysState.knob0, &sysState.knob1, &sysState.knob2, &sysState.knob3 };
+                // scanKeys applies the new position on its next pass
+                if (param < HOST_PARAM_PAN_MODE) knobs[param]->setRotation(value);
+                else if (param == HOST_PARAM_PAN_MODE && value >= 0 && value < PAN_MODE_COUNT) panMode = (PanMode)value;
+                else if (param == HOST_PARAM_DITHER && value >= 0 && value < DITHER_MODE_COUNT) ditherMode = (DitherMode)value;
+            }
+            break;
+        case HOST_PING: {
+            uint8_t echo[HOST_MAX_PAYLOAD];
+            for (uint8_t i = 0; i < frame.length; i++) echo[i] = ring[(frame.payload + i) & HOST_RX_MASK];
+            hostSend(HOST_PONG, echo, frame.length);
+            break;
+        }
+        default:  // HOST_NOP and unknown types
+            break;
+    }
+}
+
+void hostLinkTask(void * pvParameters) {
+    const volatile uint8_t* ring = HostLink_Buffer();
+    uint32_t lastRxTime = 0;
+    uint32_t lastTelemetryTime = 0;
+    bool active = false;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, (active ? HOST_POLL_ACTIVE_MS : HOST_POLL_IDLE_MS) / portTICK_PERIOD_MS);
+
+        // Parse every complete frame in the ring
+        uint32_t available = HostLink_Available();
+        while (available > 0) {
+            HostFrame frame;
+            uint32_t start = HostLink_ReadIndex();
+            HostParseResult result = HostProto_Parse(ring, HOST_RX_MASK, start, available, frame);
+            if (result == HOST_FRAME_INCOMPLETE) break;
+            uint32_t used = 1;  // Resynchronise one byte at a time
+            if (result == HOST_FRAME_OK) {
+                handleHostFrame(ring, frame);
+                hostRxFrames++;
+                lastRxTime = millis();
+                used = frame.size;
+            }
+            else if (ring[start & HOST_RX_MASK] == HOST_SYNC) {
+                hostRxErrors++;
+            }
+            HostLink_Consume(used);
+            available -= used;
+        }
+        active = (hostRxFrames > 0) && (millis() - lastRxTime < HOST_ACTIVE_MS);
+
+        // Mirrored key events go to the host only while one is talking to us
+        MidiPacket packet;
+        while (MidiBridge_TakePacket(packet)) {
+            if (active) hostSend(HOST_MIDI_OUT, packet.data, sizeof(packet.data));
+        }
+
+        if (active && millis() - lastTelemetryTime >= HOST_TELEMETRY_MS) {
+            lastTelemetryTime = millis();
+            HostTelemetry telemetry = { hostRxFrames, hostRxErrors, HostLink_GetOverrunCount(),
+                                        hostTxDropped, activeNoteCount, controlState.read().role };
+            uint8_t payload[HOST_TELEMETRY_SIZE];
+            HostProto_PackTelemetry(telemetry, payload);
+            hostSend(HOST_TELEMETRY, payload, sizeof(payload));
+        }
+    }
+}
+
+
+// --------------------------- HANDSHAKE ------------------------------------- //
+
+// Automatic position detection for stacked modules (see doc/handshaking.md).
+// Every module switches both handshake outputs on and waits for its
+// neighbours. The most westerly module (no west input) takes position 0 and
+// turns its east output off. That tells its east neighbour to take the next
+// position, and so on down the row. The most easterly module broadcasts the
+// module count. Position 0 becomes the RECEIVER, and octaves are spread
+// around octave 4 from west to east.
+enum HandshakeState { HS_SETTLE, HS_WAIT_WEST, HS_ANNOUNCED, HS_WAIT_COMPLETE, HS_DONE };
+
+const TickType_t HANDSHAKE_SETTLE_MS = 1000;   // Time for every module to power up
+const TickType_t HANDSHAKE_TIMEOUT_MS = 3000;  // Give up and keep the manual settings
+
+struct {
+    HandshakeState state;
+    TickType_t stateStart;
+    uint32_t moduleID;
+    int8_t position;
+    int8_t lastPosition;   // Highest position announced by another module
+    uint8_t moduleCount;
+    bool westPresent;      // Neighbours seen when the handshake started
+    bool eastPresent;
+    uint8_t changeCount;   // Consecutive scans with a different neighbour layout
+} handshake;
+
+// Hash of the 96-bit unique device ID
+uint32_t getModuleID() {
+    uint32_t w1 = HAL_GetUIDw1();
+    uint32_t w2 = HAL_GetUIDw2();
+    return HAL_GetUIDw0() ^ ((w1 << 11) | (w1 >> 21)) ^ ((w2 << 22) | (w2 >> 10));
+}
+
+void sendHandshake(char type, uint8_t value) {
+    uint8_t msg[8] = {0};
+    msg[0] = type;
+    msg[1] = value;
+    msg[4] = handshake.moduleID & 0xFF;
+    msg[5] = (handshake.moduleID >> 8) & 0xFF;
+    msg[6] = (handshake.moduleID >> 16) & 0xFF;
+    msg[7] = (handshake.moduleID >> 24) & 0xFF;
+    // Don't stall key scanning if nothing on the bus acknowledges frames
+    sendCANFrame(CAN_ID_HANDSHAKE, msg, 5 / portTICK_PERIOD_MS);
+}
+
+void setHandshakeState(HandshakeState state) {
+    handshake.state = state;
+    handshake.stateStart = xTaskGetTickCount();
+}
+
+// (Re)start detection: both outputs on, forget the previous layout
+void startHandshake() {
+    handshake.position = -1;
+    handshake.lastPosition = -1;
+    handshake.moduleCount = 0;
+    handshake.changeCount = 0;
+    setOutMuxBit(HKOW_BIT, HIGH);
+    setOutMuxBit(HKOE_BIT, HIGH);
+    setHandshakeState(HS_SETTLE);
+}
+
+void finishHandshake(bool success) {
+    if (success) {
+        uint8_t octave = 4 - (handshake.moduleCount - 1) / 2 + handshake.position;
+        if (octave > 8) octave = 8;
+        moduleRole = (handshake.position == 0) ? RECEIVER : SENDER;
+        sysState.knob2.setRotation(octave);
+        moduleOctave = octave;
+        publishControls();
+        requestRoleUpdate();
+        notifyUI(UI_EVT_ROLE | UI_EVT_OCTAVE);
+        logEvent(LOG_HANDSHAKE_DONE, handshake.position, handshake.moduleCount, octave);
+    }
+    else {
+        logEvent(LOG_HANDSHAKE_TIMEOUT);
+    }
+    // Hold both outputs on so neighbours can spot plugging and unplugging
+    setOutMuxBit(HKOW_BIT, HIGH);
+    setOutMuxBit(HKOE_BIT, HIGH);
+    setHandshakeState(HS_DONE);
+}
+
+// Advance the handshake; called from scanKeysTask once per scan with the
+// neighbour inputs (true = neighbour's output is on).
+void handshakeStep(bool westOn, bool eastOn) {
+    uint8_t msg[8];
+    while (xQueueReceive(handshakeQ, msg, 0) == pdPASS) {
+        uint32_t id = msg[4] | (msg[5] << 8) | (msg[6] << 16) | ((uint32_t)msg[7] << 24);
+        if (id == handshake.moduleID) continue;  // Our own frame (CAN_LOOPBACK builds)
+        if (msg[0] == 'H' && (int8_t)msg[1] > handshake.lastPosition) {
+            handshake.lastPosition = msg[1];
+        }
+        else if (msg[0] == 'C') {
+            handshake.moduleCount = msg[1];
+        }
+        else if (msg[0] == 'A') {
+            startHandshake();
+            return;
+        }
+    }
+
+    TickType_t elapsed = (xTaskGetTickCount() - handshake.stateStart) * portTICK_PERIOD_MS;
+    switch (handshake.state) {
+        case HS_SETTLE:
+            if (elapsed < HANDSHAKE_SETTLE_MS) break;
+            handshake.westPresent = westOn;
+            handshake.eastPresent = eastOn;
+            if (!westOn) {
+                handshake.position = 0;
+                sendHandshake('H', 0);
+                setHandshakeState(HS_ANNOUNCED);
+            }
+            else {
+                setHandshakeState(HS_WAIT_WEST);
+            }
+            break;
+
+        case HS_WAIT_WEST:
+            // West neighbour has taken its position and released us
+            if (!westOn) {
+                handshake.position = handshake.lastPosition + 1;
+                sendHandshake('H', handshake.position);
+                setHandshakeState(HS_ANNOUNCED);
+            }
+            else if (elapsed > HANDSHAKE_TIMEOUT_MS) {
+                finishHandshake(false);
+            }
+            break;
+
+        case HS_ANNOUNCED:
+            // One scan period after announcing, so our frame is on the bus
+            // before the east neighbour sees its west input drop.
+            setOutMuxBit(HKOE_BIT, LOW);
+            if (!handshake.eastPresent) {
+                handshake.moduleCount = handshake.position + 1;
+                sendHandshake('C', handshake.moduleCount);
+                finishHandshake(true);
+            }
+            else {
+                setHandshakeState(HS_WAIT_COMPLETE);
+            }
+            break;
+
+        case HS_WAIT_COMPLETE:
+            if (handshake.moduleCount > 0) finishHandshake(true);
+            else if (elapsed > HANDSHAKE_TIMEOUT_MS) finishHandshake(false);
+            break;
+
+        case HS_DONE:
+            // Give the neighbours time to restore their outputs, then restart
+            // detection everywhere if a module is plugged in or removed.
+            if (elapsed < HANDSHAKE_SETTLE_MS) break;
+            if (westOn != handshake.westPresent || eastOn != handshake.eastPresent) {
+                if (++handshake.changeCount >= 3) {
+                    sendHandshake('A', 0);
+                    startHandshake();
+                }
+            }
+            else {
+                handshake.changeCount = 0;
+            }
+            break;
+    }
+}
+
+
 // ----------------------- FREE RTOS TASKS ----------------------------------- //
 
 // In your global variables, change the previous state bitset to track 16 keys:
 static std::bitset<16> prevKeys;  // Now tracks keys 0-15
 static bool prevKnob1SPressed = false;
 static bool prevKnob0SPressed = false;
+static bool prevKnob3SPressed = false;
+static bool prevKnob2SPressed = false;
+static bool prevJoystickSPressed = false;
 
 // Task to scan the key matrix at a 20-50ms interval (priority 2)
 void scanKeysTask(void * pvParameters) {
@@ -380,7 +1393,7 @@ void scanKeysTask(void * pvParameters) {
         }
     }
 #else
-    const TickType_t xFrequency = 20 / portTICK_PERIOD_MS;
+    const TickType_t xFrequency = SCAN_PERIOD_MS / portTICK_PERIOD_MS;
     TickType_t xLastWakeTime = xTaskGetTickCount();
 
     static int prevTranspose = 0;
@@ -388,6 +1401,7 @@ void scanKeysTask(void * pvParameters) {
     while (1) {
         TASK_START(); // Mark start time
         vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        uint32_t scanStart = syncedMicros();
 
         // 1) Scan the full 8x4 matrix into localInputs (16 keys)
         std::bitset<32> localInputs;
@@ -400,20 +1414,21 @@ void scanKeysTask(void * pvParameters) {
             }
         }
 
-        // 2) Update shared key state (if needed)
-        xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-        sysState.inputs = localInputs;
-        xSemaphoreGive(sysState.mutex);
+        // 2) Keep the scan for the next control snapshot
+        scannedInputs = localInputs;
 
         // 3) Process note keys (first 12 keys, rows 0-2) as before
-        uint32_t localStepSize = 0;
+        uint8_t localNote = NO_NOTE;
         for (uint8_t i = 0; i < 12; i++) {
             if (!localInputs[i]) {
-                localStepSize = stepSizes[i];
+                localNote = midiNote(moduleOctave, i);
                 break;
             }
         }
-        currentStepSize = localStepSize;
+        // In distributed mode local keys are polyphonic voices instead
+        bool distributed = (voiceMode == VOICES_DISTRIBUTED);
+        currentNote = distributed ? NO_NOTE : localNote;
+        if (currentNote != NO_NOTE) audioWake();
 
         // Process note press/release events for keys 0-11:
         uint8_t currentOctave = moduleOctave;
@@ -427,7 +1442,21 @@ void scanKeysTask(void * pvParameters) {
                     TX_Message[0] = currentState ? 'P' : 'R';
                     TX_Message[1] = currentOctave;
                     TX_Message[2] = key;
-                    xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
+                    uint32_t now = syncedMicros();
+                    stampFrame(TX_Message, now);
+                    LATENCY_RECORD(LAT_SCAN, now - scanStart);
+                    MidiBridge_MirrorKey(currentState, midiNote(currentOctave, key));
+                    if (distributed) {
+                        // Render locally through the normal decode path
+                        CANFrame local = { CAN_ID_NOTE, micros(), {0} };
+                        memcpy(local.data, TX_Message, 8);
+                        xQueueSend(msgInQ, &local, 0);
+                        TX_Message[FRAME_FLAGS] |= FRAME_FLAG_RENDERED;
+                    }
+                    // Only a SENDER runs CAN_TX_Task to drain msgOutQ
+                    if (moduleRole == SENDER) {
+                        xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
+                    }
                 //}
             }
             prevKeys[key] = currentState;
@@ -438,13 +1467,19 @@ void scanKeysTask(void * pvParameters) {
         uint8_t knob3A = localInputs[12];
         uint8_t knob3B = localInputs[13];
         uint8_t knob3Curr = (knob3B << 1) | knob3A;  // Quadrature state {B, A}
+        int prevVolume = sysState.knob3.getRotation();
         sysState.knob3.update(knob3Curr);
+        if (sysState.knob3.getRotation() != prevVolume) notifyUI(UI_EVT_VOLUME);
 
         // 5) Decode knob 2 (remains unchanged)
         uint8_t knob2A = localInputs[14];
         uint8_t knob2B = localInputs[15];
         uint8_t knob2Curr = (knob2B << 1) | knob2A;  // Quadrature state {B, A}
         sysState.knob2.update(knob2Curr);
+        if (sysState.knob2.getRotation() != moduleOctave) {
+            moduleOctave = sysState.knob2.getRotation();
+            notifyUI(UI_EVT_OCTAVE);
+        }
 
         // 6) Decode knob 1 (remains unchanged)
         uint8_t knob1A = localInputs[16];
@@ -461,53 +1496,62 @@ void scanKeysTask(void * pvParameters) {
         int newTranspose = sysState.knob0.getRotation(); 
 
         if (newTranspose > prevTranspose) {
-            Serial.println("Transposing Up");
+            logEvent(LOG_TRANSPOSE, 1);
 
         } else if (newTranspose < prevTranspose) {
-            Serial.println("Transposing Down");
+            logEvent(LOG_TRANSPOSE, -1);
         }
 
         //Serial.println(newTranspose - 4);
 
         bool knob1SPressed = !localInputs[25];
         bool knob0SPressed = !localInputs[24];
-
-        if (!localInputs[20]){
-            Serial.println("Knob 2S pressed");
-        } else if (!localInputs[21]){
-            Serial.println("Knob 3S pressed");
-        } else if (!localInputs[22]){
-            Serial.println("Joystick S pressed");
+        bool knob3SPressed = !localInputs[21];
+        bool knob2SPressed = !localInputs[20];
+        bool joystickSPressed = !localInputs[22];
+
+        if (knob2SPressed && !prevKnob2SPressed){
+            displayView = (DisplayView)((displayView + 1) % VIEW_COUNT);
+            notifyUI(UI_EVT_VIEW);
+            logEvent(LOG_VIEW, displayView);
+        } else if (knob3SPressed && !prevKnob3SPressed){
+            voiceMode = (voiceMode == VOICES_CENTRAL) ? VOICES_DISTRIBUTED : VOICES_CENTRAL;
+            publishControls();
+            requestRoleUpdate();
+            notifyUI(UI_EVT_ROLE);
+            logEvent(LOG_VOICE_MODE, voiceMode);
+        } else if (joystickSPressed && !prevJoystickSPressed){
+            currentEffects = (EffectsPreset)((currentEffects + 1) % FX_PRESET_COUNT);
+            publishControls();
+            logEvent(LOG_EFFECTS, currentEffects);
         } else if (knob0SPressed && !prevKnob0SPressed){
             //Serial.println("Knob 0S pressed");
-            xSemaphoreTake(sysState.mutex, portMAX_DELAY);
             currentWaveform = (WaveformType)(((int)currentWaveform + 1) % 6);
-            xSemaphoreGive(sysState.mutex);
-            Serial.print("Waveform changed to: ");
-            if (currentWaveform == SAWTOOTH) Serial.println("Sawtooth");
-            else if (currentWaveform == TRIANGLE) Serial.println("Triangle");
-            else if (currentWaveform == SINE) Serial.println("Sine");
-            else if (currentWaveform == SQUARE) Serial.println("Square");
-            else if (currentWaveform == PULSE) Serial.println("Pulse");
-            else if (currentWaveform == NOISE) Serial.println("Noise");
-            else if (currentWaveform == PIANO) Serial.println("Piano");
-            else if (currentWaveform == RISE) Serial.println("Rise");
+            publishControls();
+            notifyUI(UI_EVT_WAVEFORM);
+            logEvent(LOG_WAVEFORM, currentWaveform);
 
         } else if (knob1SPressed && !prevKnob1SPressed){
             // Knob 1 S (!localInputs[25])
-            xSemaphoreTake(sysState.mutex, portMAX_DELAY);
             moduleRole = (moduleRole == SENDER) ? RECEIVER : SENDER;
-            xSemaphoreGive(sysState.mutex);
-            Serial.println("Role changed");        
-        }
-        else if (localInputs[23]){
-            Serial.println("West Detect Initiated");
-        }
-        else if (localInputs[27]){
-            Serial.println("East Detect Initiated");
+            publishControls();
+            requestRoleUpdate();
+            notifyUI(UI_EVT_ROLE);
+            logEvent(LOG_ROLE, moduleRole);
         }
         prevKnob1SPressed = knob1SPressed;
         prevKnob0SPressed = knob0SPressed;
+        prevKnob3SPressed = knob3SPressed;
+        prevKnob2SPressed = knob2SPressed;
+        prevJoystickSPressed = joystickSPressed;
+
+        // 8) Neighbour detection (handshake inputs read low when a neighbour's output is on)
+        sysState.westDetected = !localInputs[23];
+        sysState.eastDetected = !localInputs[27];
+        handshakeStep(sysState.westDetected, sysState.eastDetected);
+
+        // 9) One consistent snapshot per scan for the other tasks and the ISR
+        publishControls();
 
         TASK_END(maxScanKeysTime); // Update worst-case time
 
@@ -515,86 +1559,456 @@ void scanKeysTask(void * pvParameters) {
 #endif
 }
 
-// Task to update the display and poll for received CAN messages (priority 1)
-void displayUpdateTask(void * pvParameters) {
-    const TickType_t xFrequency = 100 / portTICK_PERIOD_MS;
-    TickType_t xLastWakeTime = xTaskGetTickCount();
+// ------------------------- SCOPE & SPECTRUM -------------------------------- //
+
+// Oscilloscope and spectrum of the latest output samples. The ISR only copies
+// samples while analysisTask has a capture armed; the FFT runs in that task
+// at idle priority so it can never delay audio or the other tasks.
+const uint16_t FFT_SIZE = 256;           // Capture length, power of two
+const uint8_t FFT_STAGES = 8;            // log2(FFT_SIZE)
+const uint8_t SCOPE_WIDTH = 128;
+const uint8_t SPECTRUM_BANDS = 32;
+const uint32_t ANALYSIS_PERIOD_MS = 50;
+
+// Capture buffer, written by the audio ISR. Index == FFT_SIZE means disarmed.
+uint8_t scopeCapture[FFT_SIZE];
+volatile uint16_t scopeCaptureIndex = FFT_SIZE;
+
+inline void captureSample(uint8_t sample) {
+    uint16_t i = scopeCaptureIndex;
+    if (i < FFT_SIZE) {
+        scopeCapture[i] = sample;
+        scopeCaptureIndex = i + 1;
+    }
+}
 
-    while (1) {
-        TASK_START();
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
-        digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+// Results for the display, double buffered so a frame is never read half written
+struct AnalysisFrame {
+    uint8_t scope[SCOPE_WIDTH];          // Output sample, 0-255
+    uint8_t bands[SPECTRUM_BANDS];       // Bar height in pixels, 0-32
+};
+AnalysisFrame analysisFrames[2];
+uint8_t readyAnalysisFrame = 0;
+volatile uint32_t analysisFrameCount = 0;   // Bumped for every new frame
+
+// Q15 sine over 3/4 of a period, so cos(x) = sin(x + N/4) uses the same table
+int16_t fftSine[FFT_SIZE * 3 / 4];
+int16_t fftRe[FFT_SIZE];
+int16_t fftIm[FFT_SIZE];
+uint8_t bandEdges[SPECTRUM_BANDS + 1];   // First FFT bin of each band
+
+void initAnalysisTables() {
+    for (uint16_t i = 0; i < FFT_SIZE * 3 / 4; i++) {
+        fftSine[i] = (int16_t)(sinf(6.28318530718f * i / FFT_SIZE) * 32767.0f);
+    }
+    // Bands spaced logarithmically from bin 1 to bin N/2, at least one bin wide
+    bandEdges[0] = 1;
+    for (uint8_t b = 1; b <= SPECTRUM_BANDS; b++) {
+        uint8_t edge = (uint8_t)(powf(FFT_SIZE / 2, (float)b / SPECTRUM_BANDS) + 0.5f);
+        if (edge <= bandEdges[b - 1]) edge = bandEdges[b - 1] + 1;
+        bandEdges[b] = edge;
+    }
+    bandEdges[SPECTRUM_BANDS] = FFT_SIZE / 2;
+    for (uint8_t i = 0; i < 2; i++) {
+        memset(analysisFrames[i].scope, 128, SCOPE_WIDTH);
+        memset(analysisFrames[i].bands, 0, SPECTRUM_BANDS);
+    }
+}
+
+// In-place radix-2 FFT on Q15 data. Every stage halves the values so nothing
+// can overflow; the result is scaled by 1/FFT_SIZE.
+void fixedFFT(int16_t re[], int16_t im[]) {
+    for (uint16_t i = 1, j = 0; i < FFT_SIZE; i++) {
+        uint16_t bit = FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (uint16_t len = 2; len <= FFT_SIZE; len <<= 1) {
+        uint16_t half = len >> 1;
+        uint16_t step = FFT_SIZE / len;
+        for (uint16_t i = 0; i < FFT_SIZE; i += len) {
+            for (uint16_t k = 0; k < half; k++) {
+                int32_t wr = fftSine[k * step + FFT_SIZE / 4];
+                int32_t wi = -fftSine[k * step];
+                uint16_t a = i + k;
+                uint16_t b = a + half;
+                int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+                int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+                re[b] = (re[a] - tr) >> 1;
+                im[b] = (im[a] - ti) >> 1;
+                re[a] = (re[a] + tr) >> 1;
+                im[a] = (im[a] + ti) >> 1;
+            }
+        }
+    }
+}
+
+void analyseCapture(AnalysisFrame &frame) {
+    // Scope: start at the first rising crossing of mid-scale so the trace stands still
+    uint16_t start = 0;
+    for (uint16_t i = 1; i < FFT_SIZE - SCOPE_WIDTH; i++) {
+        if (scopeCapture[i - 1] < 128 && scopeCapture[i] >= 128) {
+            start = i;
+            break;
+        }
+    }
+    memcpy(frame.scope, &scopeCapture[start], SCOPE_WIDTH);
+
+    // Spectrum: Hann window, sin^2(pi*n/N), approximated from the same table
+    for (uint16_t n = 0; n < FFT_SIZE; n++) {
+        int32_t s = fftSine[n >> 1];
+        int32_t window = (s * s) >> 15;
+        fftRe[n] = (int16_t)((((int32_t)scopeCapture[n] - 128) * 256 * window) >> 15);
+        fftIm[n] = 0;
+    }
+    fixedFFT(fftRe, fftIm);
+
+    for (uint8_t b = 0; b < SPECTRUM_BANDS; b++) {
+        uint32_t peak = 0;
+        for (uint16_t k = bandEdges[b]; k < bandEdges[b + 1]; k++) {
+            // |z| ~ max + min/2
+            uint32_t x = abs(fftRe[k]);
+            uint32_t y = abs(fftIm[k]);
+            uint32_t mag = (x > y) ? x + (y >> 1) : y + (x >> 1);
+            if (mag > peak) peak = mag;
+        }
+        // About 3 pixels per 6 dB, full scale is bit 12
+        uint8_t height = 0;
+        if (peak > 0) {
+            uint8_t log2Peak = 31 - __builtin_clz(peak);
+            uint8_t halfStep = (log2Peak > 0) ? (peak >> (log2Peak - 1)) & 1 : 0;
+            height = log2Peak * 5 / 2 + halfStep;
+            if (height > 32) height = 32;
+        }
+        frame.bands[b] = height;
+    }
+}
+
+// Capture and analyse the output while a graphical view is shown (priority 0)
+void analysisTask(void * pvParameters) {
+    const TickType_t xFrequency = ANALYSIS_PERIOD_MS / portTICK_PERIOD_MS;
+    const TickType_t captureTicks = (FFT_SIZE * 1000 / sampleRate) / portTICK_PERIOD_MS + 1;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        if (displayView == VIEW_STATUS || !audioRunning) continue;
+
+        // Arm the ISR and wait for it to fill the buffer. If the renderer is
+        // stopped (e.g. a SENDER) the capture never finishes and is dropped.
+        scopeCaptureIndex = 0;
+        vTaskDelay(captureTicks);
+        if (scopeCaptureIndex < FFT_SIZE) {
+            scopeCaptureIndex = FFT_SIZE;
+            continue;
+        }
+
+        uint8_t next = __atomic_load_n(&readyAnalysisFrame, __ATOMIC_RELAXED) ^ 1;
+        analyseCapture(analysisFrames[next]);
+        __atomic_store_n(&readyAnalysisFrame, next, __ATOMIC_RELEASE);
+        analysisFrameCount++;
+        notifyUI(UI_EVT_ANALYSIS);
+    }
+}
+
+// ------------------------- RETAINED DISPLAY -------------------------------- //
+
+// The display keeps the last drawn value of every UI field. Each frame only
+// fields whose value changed are redrawn, and only the 8x8 pixel tiles they
+// touch are sent over I2C (u8g2 updateDisplayArea) instead of the whole
+// 512-byte frame.
+enum UIField { UI_ROLE = 0, UI_JOYSTICK, UI_WAVEFORM, UI_OCTAVE, UI_VOLUME, UI_LAST_RX, UI_FIELD_COUNT };
+
+// Field area to clear (non-overlapping) and text baseline position
+struct UIBox { uint8_t x, y, w, h, textX, textY; };
+const UIBox uiBoxes[UI_FIELD_COUNT] = {
+    {  0,  0, 75, 13,  2, 10 },  // UI_ROLE
+    { 75,  0, 53, 13, 75, 10 },  // UI_JOYSTICK
+    {  0, 13, 66, 10,  2, 20 },  // UI_WAVEFORM
+    { 66, 13, 62, 10, 66, 20 },  // UI_OCTAVE
+    {  0, 23, 66,  9,  2, 30 },  // UI_VOLUME
+    { 66, 23, 62,  9, 66, 30 },  // UI_LAST_RX
+};
+
+// Snapshot of everything shown on screen
+struct UIState {
+    ModuleRole role;
+    VoiceMode voiceMode;
+    int joyX, joyY;
+    WaveformType waveform;
+    uint8_t octave;
+    int volume;
+    uint8_t lastRX[3];
+};
+
+const uint8_t DISPLAY_TILE_ROWS = 4;
+uint16_t dirtyTiles[DISPLAY_TILE_ROWS];  // One bit per 8-pixel tile column
+
+// The display only redraws when notified of a change, at most this often.
+// DMA transfers run in the background, so the bus time does not limit it.
+const uint32_t DISPLAY_MAX_FPS = 30;
+const uint32_t DISPLAY_MIN_FRAME_MS = 1000 / DISPLAY_MAX_FPS;
+// The joystick has no producer task, so it is polled at this interval
+const uint32_t JOYSTICK_POLL_MS = 50;
+
+// I2C transfer time of the last frame and the worst so far (us), bytes sent,
+// and how long the task spent queuing them
+volatile uint32_t lastDisplayTransferTime = 0;
+volatile uint32_t maxDisplayTransferTime = 0;
+volatile uint32_t lastDisplayTransferBytes = 0;
+volatile uint32_t lastDisplayQueueTime = 0;
+
+const char* waveformName(WaveformType waveform) {
+    switch (waveform) {
+        case SAWTOOTH: return "Sawtooth";
+        case TRIANGLE: return "Triangle";
+        case SINE:     return "Sine";
+        case SQUARE:   return "Square";
+        case PULSE:    return "Pulse";
+        case NOISE:    return "Noise";
+        case PIANO:    return "Piano";
+        case RISE:     return "Rise";
+    }
+    return "";
+}
+
+// Refresh the fields named in events, without taking any lock
+void readUIState(UIState &ui, uint32_t events) {
+    if (events & (UI_EVT_ROLE | UI_EVT_WAVEFORM | UI_EVT_OCTAVE)) {
+        ControlSnapshot controls = controlState.read();
+        ui.role = controls.role;
+        ui.voiceMode = controls.voiceMode;
+        ui.waveform = controls.waveform;
+        ui.octave = controls.octave;
+    }
+    if (events & UI_EVT_JOYSTICK) {
+        ui.joyX = joyX12Val;
+        ui.joyY = joyY12Val;
+    }
+    if (events & UI_EVT_VOLUME) ui.volume = sysState.knob3.getRotation();
+    if (events & UI_EVT_RX) {
+        RXMessage rx = lastRXMessage.read();
+        memcpy(ui.lastRX, rx.data, sizeof(ui.lastRX));
+    }
+}
+
+bool uiFieldChanged(UIField field, const UIState &a, const UIState &b) {
+    switch (field) {
+        case UI_ROLE:     return a.role != b.role || a.voiceMode != b.voiceMode;
+        case UI_JOYSTICK: return a.joyX != b.joyX || a.joyY != b.joyY;
+        case UI_WAVEFORM: return a.waveform != b.waveform;
+        case UI_OCTAVE:   return a.octave != b.octave;
+        case UI_VOLUME:   return a.volume != b.volume;
+        case UI_LAST_RX:  return memcmp(a.lastRX, b.lastRX, sizeof(a.lastRX)) != 0;
+        default:          return false;
+    }
+}
+
+void drawUIField(UIField field, const UIState &ui) {
+    const UIBox &box = uiBoxes[field];
+    u8g2.setDrawColor(0);
+    u8g2.drawBox(box.x, box.y, box.w, box.h);
+    u8g2.setDrawColor(1);
+    u8g2.setCursor(box.textX, box.textY);
+    switch (field) {
+        case UI_ROLE:
+            u8g2.print(ui.role == SENDER ? "SENDER" : "RECEIVER");
+            if (ui.voiceMode == VOICES_DISTRIBUTED) u8g2.drawStr(62, box.textY, "D");
+            break;
+        case UI_JOYSTICK:
+            // Joystick values in the form (12,34)
+            u8g2.print("(");
+            u8g2.print(ui.joyX);
+            u8g2.print(",");
+            u8g2.print(ui.joyY);
+            u8g2.print(")");
+            break;
+        case UI_WAVEFORM:
+            u8g2.print(waveformName(ui.waveform));
+            break;
+        case UI_OCTAVE:
+            u8g2.print("Pitch: ");
+            u8g2.print(ui.octave);
+            break;
+        case UI_VOLUME:
+            u8g2.print("Volume: ");
+            u8g2.print(ui.volume);
+            break;
+        case UI_LAST_RX:
+            u8g2.print((char)ui.lastRX[0]);
+            u8g2.print(ui.lastRX[1]);
+            u8g2.print(ui.lastRX[2]);
+            break;
+        default:
+            break;
+    }
 
-        // Update joystick values outside of the ISR
-        int rawJoyX = analogRead(JOYX_PIN);
-        int rawJoyY = analogRead(JOYY_PIN);
-        // Use the same ymin and ymax as in sampleISR (adjust if needed)
-        joyX12Val = map(rawJoyX, 800, 119, 0, 12);
-        joyY12Val = map(rawJoyY, 800, 119, 0, 12);
+    // Mark every tile the box overlaps
+    uint8_t firstCol = box.x / 8, lastCol = (box.x + box.w - 1) / 8;
+    uint8_t firstRow = box.y / 8, lastRow = (box.y + box.h - 1) / 8;
+    for (uint8_t row = firstRow; row <= lastRow; row++) {
+        for (uint8_t col = firstCol; col <= lastCol; col++) {
+            dirtyTiles[row] |= (1 << col);
+        }
+    }
+}
+
+// Called from the DMA interrupt when the transfer queue runs empty
+void displayDoneISR() {
+    uint32_t elapsed = DisplayDMA_GetLastTransferTime();
+    lastDisplayTransferTime = elapsed;
+    if (elapsed > maxDisplayTransferTime) maxDisplayTransferTime = elapsed;
 
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (displayUpdateHandle != NULL) {
+        xTaskNotifyFromISR(displayUpdateHandle, UI_EVT_DMA_DONE, eSetBits, &xHigherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
 
-        // Read sysState.knob3Rotation under the mutex
-        xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-        int rotationCopy = sysState.knob3.getRotation();
-        xSemaphoreGive(sysState.mutex);
+// Queue the dirty tiles, one contiguous run per tile row
+void flushDirtyTiles() {
+    // displayUpdateTask never starts a frame while one is in flight; tests
+    // running before the scheduler just wait here
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        DisplayDMA_WaitIdle();
+    }
+    uint32_t start = micros();
+    uint32_t bytes = 0;
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++) {
+        if (dirtyTiles[row] == 0) continue;
+        uint8_t first = __builtin_ctz(dirtyTiles[row]);
+        uint8_t last = 15 - __builtin_clz((uint32_t)dirtyTiles[row] << 16);
+        u8g2.updateDisplayArea(first, row, last - first + 1, 1);
+        bytes += (last - first + 1) * 8;
+        dirtyTiles[row] = 0;
+    }
+    if (bytes > 0) {
+        lastDisplayQueueTime = micros() - start;
+        lastDisplayTransferBytes = bytes;
+    }
+}
 
+// Draw the latest scope trace or spectrum over the whole screen
+void drawAnalysisView(DisplayView view) {
+    const AnalysisFrame &frame = analysisFrames[__atomic_load_n(&readyAnalysisFrame, __ATOMIC_ACQUIRE)];
+    u8g2.clearBuffer();
+    if (view == VIEW_SCOPE) {
+        // 0-255 maps to y 31-0
+        for (uint8_t x = 1; x < SCOPE_WIDTH; x++) {
+            u8g2.drawLine(x - 1, 31 - (frame.scope[x - 1] >> 3), x, 31 - (frame.scope[x] >> 3));
+        }
+    } else {
+        // 4-pixel columns with a 1-pixel gap
+        for (uint8_t b = 0; b < SPECTRUM_BANDS; b++) {
+            uint8_t height = frame.bands[b];
+            if (height > 0) u8g2.drawBox(b * 4, 32 - height, 3, height);
+        }
+    }
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++) {
+        dirtyTiles[row] = 0xFFFF;
+    }
+}
+
+// Redraw the fields named in events that changed (or everything for
+// UI_EVT_REDRAW) and send them
+void renderDisplayFrame(uint32_t events) {
+    static UIState current;
+    static UIState shown;
+    static bool firstFrame = true;
+    static DisplayView shownView = VIEW_STATUS;
+    static uint32_t shownAnalysisFrame = 0;
+
+    bool fullRedraw = (events & UI_EVT_REDRAW) != 0;
+    if (firstFrame) {
         u8g2.clearBuffer();
         u8g2.setFont(u8g2_font_ncenB08_tr);
-        u8g2.drawStr(2,10,moduleRole == SENDER ? "SENDER" : "RECEIVER");
-
-        // Display current JOYX and JOYY values in the form (12,34)
-        u8g2.setCursor(75, 10);
-        u8g2.print("(");
-        u8g2.print(joyX12Val);
-        u8g2.print(",");
-        u8g2.print(joyY12Val);
-        u8g2.print(")");
-    
+        fullRedraw = true;
+        firstFrame = false;
+    }
+
+    DisplayView view = displayView;
+    if (view != VIEW_STATUS) {
+        uint32_t frameCount = analysisFrameCount;
+        if (fullRedraw || view != shownView || frameCount != shownAnalysisFrame) {
+            drawAnalysisView(view);
+            shownAnalysisFrame = frameCount;
+        }
+        shownView = view;
+        flushDirtyTiles();
+        return;
+    }
+    if (shownView != VIEW_STATUS) {
+        // Coming back from a graphical view: the text fields need redrawing
+        u8g2.clearBuffer();
+        fullRedraw = true;
+        shownView = VIEW_STATUS;
+    }
+
+    if (fullRedraw) events |= UI_EVT_FIELDS;
+    readUIState(current, events);
+    for (uint8_t f = 0; f < UI_FIELD_COUNT; f++) {
+        bool notified = (events & (1 << f)) != 0;
+        if (fullRedraw || (notified && uiFieldChanged((UIField)f, current, shown))) {
+            drawUIField((UIField)f, current);
+        }
+    }
+    shown = current;
+    flushDirtyTiles();
+}
+
+// Read the joystick, returns true if the displayed value changed
+bool pollJoystick() {
+    int rawJoyX = analogRead(JOYX_PIN);
+    int rawJoyY = analogRead(JOYY_PIN);
+    // Use the same ymin and ymax as the audio ISR (adjust if needed)
+    int newX = map(rawJoyX, 800, 119, 0, 12);
+    int newY = map(rawJoyY, 800, 119, 0, 12);
+    bool changed = (newX != joyX12Val) || (newY != joyY12Val);
+    joyX12Val = newX;
+    joyY12Val = newY;
+    return changed;
+}
+
+// Task to update the display when notified of a change and poll the joystick (priority 1)
+void displayUpdateTask(void * pvParameters) {
+    const TickType_t minFrameTicks = DISPLAY_MIN_FRAME_MS / portTICK_PERIOD_MS;
+    const TickType_t joystickTicks = JOYSTICK_POLL_MS / portTICK_PERIOD_MS;
+    TickType_t lastFrame = xTaskGetTickCount() - minFrameTicks;
+    uint32_t pending = UI_EVT_REDRAW;
+
+    while (1) {
+        // Sleep until something changes, or until the joystick is due
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, joystickTicks);
+        pending |= events;
+
+        TASK_START();
+        if (pollJoystick()) pending |= UI_EVT_JOYSTICK;
+
+        // Never queue a frame on top of one still being sent; the DMA done
+        // event wakes us again
+        pending &= ~UI_EVT_DMA_DONE;
+        if (pending == 0 || DisplayDMA_Busy()) continue;
+
+        // Rate limit, collecting whatever else changes in the meantime
+        TickType_t sinceLast = xTaskGetTickCount() - lastFrame;
+        if (sinceLast < minFrameTicks) {
+            vTaskDelay(minFrameTicks - sinceLast);
+            events = 0;
+            xTaskNotifyWait(0, UINT32_MAX, &events, 0);
+            pending |= events & ~UI_EVT_DMA_DONE;
+        }
+        lastFrame = xTaskGetTickCount();
+
+        digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+        renderDisplayFrame(pending);
+        pending = 0;
 
-        // Display key matrix state
-        // u8g2.setCursor(2,20);
-        // xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-        // u8g2.print(sysState.inputs.to_ulong(), HEX);
-        // xSemaphoreGive(sysState.mutex);
-
-        // Display the current waveform
-        u8g2.setCursor(2, 20);
-        if (currentWaveform == SAWTOOTH) u8g2.print("Sawtooth");
-        else if (currentWaveform == TRIANGLE) u8g2.print("Triangle");
-        else if (currentWaveform == SINE) u8g2.print("Sine");
-        else if (currentWaveform == SQUARE) u8g2.print("Square");
-        else if (currentWaveform == PULSE) u8g2.print("Pulse");
-        else if (currentWaveform == NOISE) u8g2.print("Noise");
-        else if (currentWaveform == PIANO) u8g2.print("Piano");
-        else if (currentWaveform == RISE) u8g2.print("Rise");
-
-
-        u8g2.setCursor(2, 30);
-        u8g2.print("Volume: ");
-        // Read the knob value using the class method
-        u8g2.print(rotationCopy);
-
-        u8g2.setCursor(66, 20);
-        u8g2.print("Pitch: ");
-        u8g2.print(moduleOctave);
-
-
-        // Now display the last received CAN message.
-        xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-        u8g2.setCursor(66,30);
-        // Serial.print("RX: ");
-        // for (uint8_t i = 0; i < 8; i++) {
-        //     Serial.print(sysState.RX_Message[i], HEX);
-        //     Serial.print(" ");
-        // }
-        //Serial.println(sysState.RX_Message[0]);
-        u8g2.print(sysState.RX_Message[0] == 'P' ? "P" : "R");
-        u8g2.print(sysState.RX_Message[1]);
-        u8g2.print(sysState.RX_Message[2]);
-        xSemaphoreGive(sysState.mutex);
-
-        u8g2.sendBuffer();
-        digitalToggle(LED_BUILTIN);
         TASK_END(maxDisplayUpdateTime);
     }
 }
@@ -603,18 +2017,104 @@ void displayUpdateTask(void * pvParameters) {
 
 
 
+// -------------------------- TIME SYNC -------------------------------------- //
+
+// Follower side of the sync protocol, called by decodeTask for SYNC and
+// FOLLOW_UP frames. The master ignores its own frames (CAN_LOOPBACK builds).
+void handleSyncFrame(const CANFrame &frame) {
+    static uint8_t pendingSeq = 0;
+    static uint32_t pendingRx = 0;
+    static bool pending = false;
+
+    if (controlState.read().role == RECEIVER) return;
+
+    if (frame.id == CAN_ID_SYNC) {
+        pendingSeq = frame.data[1];
+        pendingRx = frame.rxTime;
+        pending = true;
+    }
+    else if (frame.id == CAN_ID_FOLLOW_UP && pending && frame.data[1] == pendingSeq) {
+        uint32_t masterTx = frame.data[4] | (frame.data[5] << 8) | (frame.data[6] << 16) | ((uint32_t)frame.data[7] << 24);
+        clockSync.onSync(pendingRx, masterTx);
+        pending = false;
+    }
+}
+
+// Master side: the RECEIVER broadcasts a SYNC/FOLLOW_UP pair every SYNC_PERIOD_MS (priority 1)
+void timeSyncTask(void * pvParameters) {
+    const TickType_t xFrequency = SYNC_PERIOD_MS / portTICK_PERIOD_MS;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    uint8_t seq = 0;
+
+    while (1) {
+        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        if (controlState.read().role != RECEIVER) continue;
+
+        // CAN_TX_ISR records the time and notifies this task when the
+        // mailbox holding the SYNC completes. With no other node to ACK it
+        // the frame never goes out, so give up on this period after
+        // SYNC_TX_TIMEOUT_MS instead of waiting (and waking) indefinitely.
+        ulTaskNotifyTake(pdTRUE, 0);  // Drop a late completion from last period
+        uint8_t msg[8] = {0};
+        msg[0] = 'S';
+        msg[1] = ++seq;
+        if (!sendCANFrame(CAN_ID_SYNC, msg, SYNC_TX_TIMEOUT_MS / portTICK_PERIOD_MS, &syncTxMailbox)) continue;
+        if (ulTaskNotifyTake(pdTRUE, SYNC_TX_TIMEOUT_MS / portTICK_PERIOD_MS) == 0) {
+            syncTxMailbox = 0;
+            continue;
+        }
+
+        uint32_t txTime = clockSync.toSynced(syncTxTime);
+        msg[0] = 'F';
+        msg[4] = txTime & 0xFF;
+        msg[5] = (txTime >> 8) & 0xFF;
+        msg[6] = (txTime >> 16) & 0xFF;
+        msg[7] = (txTime >> 24) & 0xFF;
+        sendCANFrame(CAN_ID_FOLLOW_UP, msg, SYNC_TX_TIMEOUT_MS / portTICK_PERIOD_MS);
+    }
+}
+
+
 // -------------------------- DECODE TASK  ----------------------------------- //
 
+// Velocity of a press or value of a key pressure frame
+inline uint8_t frameValue(const uint8_t* msg) {
+    return msg[FRAME_FLAGS] >> FRAME_VALUE_SHIFT;
+}
+
 void decodeTask(void * pvParameters) {
-    uint8_t localMsg[8];
+    CANFrame frame;
+    uint8_t *localMsg = frame.data;
     for (;;) {
         // Block until a message is available:
-        if (xQueueReceive(msgInQ, localMsg, portMAX_DELAY) == pdPASS) {
+        if (xQueueReceive(msgInQ, &frame, portMAX_DELAY) == pdPASS) {
+            if (frame.id == CAN_ID_HANDSHAKE) {
+                xQueueSend(handshakeQ, frame.data, 0);
+                continue;
+            }
+            if (frame.id != CAN_ID_NOTE) {
+                handleSyncFrame(frame);
+                continue;
+            }
             TASK_START();
-            if (localMsg[0] == 'R') {  // Release message: remove the note.
-                uint8_t note = localMsg[2];
+#ifdef MEASURE_LATENCY
+            uint32_t decodedAt = syncedMicros();
+            LATENCY_RECORD(LAT_DECODE, decodedAt - clockSync.toSynced(frame.rxTime));
+            uint32_t latencyOrigin = frameStamp(localMsg);
+#endif
+            // The audio ISR advances and removes voices for a whole block at a
+            // time, so every change to activeNotes below is made with it
+            // masked; a torn ActiveNote would corrupt its filter and
+            // modulation state, not just one phase word.
+            if (localMsg[FRAME_FLAGS] & FRAME_FLAG_RENDERED) {
+                // The sender plays this note itself (distributed voices); only
+                // show it on the display.
+            }
+            else if (localMsg[0] == 'R') {  // Release message: remove the note.
+                uint8_t note = midiNote(localMsg[1], localMsg[2]);
+                taskENTER_CRITICAL();
                 for (uint8_t i = 0; i < activeNoteCount; i++) {
-                    if (activeNotes[i].stepSize == stepSizes[note]) {
+                    if (activeNotes[i].note == note) {
                         // Remove the note by shifting the remaining notes
                         for (uint8_t j = i; j < activeNoteCount - 1; j++) {
                             activeNotes[j] = activeNotes[j + 1];
@@ -623,17 +2123,43 @@ void decodeTask(void * pvParameters) {
                         break;
                     }
                 }
+                taskEXIT_CRITICAL();
+            }
+            else if (localMsg[0] == 'A') {  // Key pressure for a held note
+                uint8_t note = midiNote(localMsg[1], localMsg[2]);
+                uint8_t pressure = frameValue(localMsg);
+                taskENTER_CRITICAL();
+                for (uint8_t i = 0; i < activeNoteCount; i++) {
+                    if (activeNotes[i].note == note) activeNotes[i].pressure = pressure;
+                }
+                taskEXIT_CRITICAL();
             }
             else if (localMsg[0] == 'P') {  // Press message: add the note.
-                uint8_t octave = localMsg[1];
-                uint8_t note = localMsg[2];
-                if (note < 12) {
-                    uint32_t step = stepSizes[note];
+                uint8_t key = localMsg[2];
+                if (key < 12) {
+                    uint8_t note = midiNote(localMsg[1], key);
+                    uint32_t step = noteStep(note);  // Until the next control block
+                    uint8_t velocity = frameValue(localMsg);
+                    if (velocity == 0) velocity = MIDI_KEY_VELOCITY;
+                    uint8_t pan = panPosition(note, localMsg[1]);
+                    audioWake();
+                    taskENTER_CRITICAL();
                     // If there's room, add a new note.
                     if (activeNoteCount < MAX_POLYPHONY) {
-                        activeNotes[activeNoteCount].stepSize = step;
+                        activeNotes[activeNoteCount].step = step;
                         activeNotes[activeNoteCount].phaseAcc = 0;
                         activeNotes[activeNoteCount].elapsed = 0; // reset elapsed time
+                        activeNotes[activeNoteCount].note = note;
+                        activeNotes[activeNoteCount].velocity = velocity;
+                        activeNotes[activeNoteCount].pressure = 0;
+                        activeNotes[activeNoteCount].pan = pan;
+                        activeNotes[activeNoteCount].mod.ready = false;
+                        SVF_Reset(activeNotes[activeNoteCount].filter);
+#ifdef MEASURE_LATENCY
+                        activeNotes[activeNoteCount].latencyOrigin = latencyOrigin;
+                        activeNotes[activeNoteCount].decodedAt = decodedAt;
+                        activeNotes[activeNoteCount].latencyPending = true;
+#endif
                         activeNoteCount++;
                     }
                     else {
@@ -646,10 +2172,22 @@ void decodeTask(void * pvParameters) {
                                 idxToSteal = i;
                             }
                         }
-                        activeNotes[idxToSteal].stepSize = step;
+                        activeNotes[idxToSteal].step = step;
                         activeNotes[idxToSteal].phaseAcc = 0;
                         activeNotes[idxToSteal].elapsed = 0;
+                        activeNotes[idxToSteal].note = note;
+                        activeNotes[idxToSteal].velocity = velocity;
+                        activeNotes[idxToSteal].pressure = 0;
+                        activeNotes[idxToSteal].pan = pan;
+                        activeNotes[idxToSteal].mod.ready = false;
+                        SVF_Reset(activeNotes[idxToSteal].filter);
+#ifdef MEASURE_LATENCY
+                        activeNotes[idxToSteal].latencyOrigin = latencyOrigin;
+                        activeNotes[idxToSteal].decodedAt = decodedAt;
+                        activeNotes[idxToSteal].latencyPending = true;
+#endif
                     }
+                    taskEXIT_CRITICAL();
                 }
             }
 
@@ -658,21 +2196,22 @@ void decodeTask(void * pvParameters) {
             // Serial.println(activeNoteCount);
             // Serial.print("Active notes: ");
             // for (uint8_t i = 0; i < activeNoteCount; i++) {
-            //     Serial.print(activeNotes[i].stepSize);
+            //     Serial.print(activeNotes[i].step);
             //     Serial.print(" ");
             // }
             // Serial.println();
 
             // Reset activeNotes
             // for (uint8_t i = 0; i < activeNoteCount; i++) {
-            //     activeNotes[i].stepSize = 0;
+            //     activeNotes[i].step = 0;
             //     activeNotes[i].phaseAcc = 0;
             // }
             
-            // Update the global RX_Message
-            xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-            memcpy(sysState.RX_Message, localMsg, sizeof(sysState.RX_Message));
-            xSemaphoreGive(sysState.mutex);
+            // Publish for the display
+            RXMessage rx;
+            memcpy(rx.data, localMsg, sizeof(rx.data));
+            lastRXMessage.write(rx);
+            notifyUI(UI_EVT_RX);
             TASK_END(maxDecodeTime);
             
         }
@@ -681,25 +2220,118 @@ void decodeTask(void * pvParameters) {
 
 
 
+// Started and stopped by roleManagerTask; only runs on a SENDER.
 void CAN_TX_Task (void * pvParameters) {
-	// If not SENDER, suspend this task.
-    if (moduleRole != SENDER) {
-        while (1) { vTaskDelay(portMAX_DELAY); }
-    }
     uint8_t msgOut[8];
     while (1) {
         xQueueReceive(msgOutQ, msgOut, portMAX_DELAY);
+        if (msgOut[0] == 0) {
+            // Stop request: park at a safe point (no mailbox held) and let
+            // the role manager delete us.
+            xSemaphoreGive(txStoppedSemaphore);
+            vTaskSuspend(NULL);
+        }
         TASK_START();
-        xSemaphoreTake(CAN_TX_Semaphore, portMAX_DELAY);
-        CAN_TX(0x123, msgOut);
+        // Record how long the frame waited in msgOutQ so the receiver can
+        // separate queueing from bus time.
+        uint32_t queueDelay = stampAge(msgOut, syncedMicros());
+        msgOut[FRAME_QUEUE_DELAY] = (queueDelay / 32 > 255) ? 255 : queueDelay / 32;
+        LATENCY_RECORD(LAT_QUEUE, queueDelay);
+        sendCANFrame(CAN_ID_NOTE, msgOut);
         TASK_END(maxCAN_TX_Time);
     }
 }
 
+// ------------------------- ROLE MANAGER ------------------------------------ //
+
+// Role and voice mode can change at runtime (Knob 1S, Knob 3S, handshake).
+// This task owns the pipelines that depend on them:
+//   - CAN_TX_Task only exists on a SENDER; it is deleted when the module
+//     becomes a RECEIVER and recreated on demand on one static stack and TCB,
+//     which are reused across role switches
+//   - note frames are only accepted by the CAN filter on a RECEIVER
+//   - the sample timer only runs when this module renders audio
+const TickType_t ROLE_SWITCH_TIMEOUT_MS = 20;
+
+#ifdef MEASURE_TASK_TIMES
+volatile uint32_t maxRoleSwitchTime = 0;
+#endif
+
+// CAN_TX_Task comes and goes with the role but always reuses this stack.
+// It is only deleted from the role manager, and FreeRTOS releases a static
+// task deleted by another task immediately, so the memory is free again.
+StackType_t CAN_TX_Stack[128];
+StaticTask_t CAN_TX_TCB;
+
+void startTxPipeline() {
+    CAN_TX_Handle = xTaskCreateStatic(CAN_TX_Task, "CAN_TX_Task", sizeof(CAN_TX_Stack) / sizeof(StackType_t),
+                                      NULL, 1, CAN_TX_Stack, &CAN_TX_TCB);
+}
+
+void stopTxPipeline() {
+    // Pending notes are dropped: a RECEIVER doesn't send them
+    xQueueReset(msgOutQ);
+    // Raise the task's priority so it reaches the stop request promptly
+    vTaskPrioritySet(CAN_TX_Handle, 2);
+    uint8_t stopMsg[8] = {0};
+    xQueueSendToFront(msgOutQ, stopMsg, 0);
+    if (xSemaphoreTake(txStoppedSemaphore, ROLE_SWITCH_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+        // Still waiting for a mailbox (nothing acknowledging on the bus);
+        // it holds no mailbox either, so it can be deleted there.
+        xQueueReset(msgOutQ);
+    }
+    vTaskDelete(CAN_TX_Handle);
+    CAN_TX_Handle = NULL;
+}
+
+void setRenderPipeline(bool on) {
+    taskENTER_CRITICAL();
+    renderEnabled = on;
+    if (on && !audioRunning) startSampleTimer();  // Stops again if nothing sounds
+    else if (!on && audioRunning) stopSampleTimer();
+    taskEXIT_CRITICAL();
+}
+
+void roleManagerTask(void * pvParameters) {
+    bool renderRunning = true;  // setup() starts the sample timer
+    while (1) {
+        uint32_t tStart = micros();
+        ControlSnapshot controls = controlState.read();
+        ModuleRole role = controls.role;
+        bool txWanted = (role == SENDER);
+        bool renderWanted = (role == RECEIVER) || (controls.voiceMode == VOICES_DISTRIBUTED);
+
+        if (txWanted && CAN_TX_Handle == NULL) {
+            startTxPipeline();
+            disableCANFilter(1);
+        }
+        else if (!txWanted && CAN_TX_Handle != NULL) {
+            stopTxPipeline();
+        }
+        if (role == RECEIVER) {
+            setCANFilter(CAN_ID_NOTE, CAN_NOTE_MASK, 1);
+        }
+        if (renderWanted != renderRunning) {
+            setRenderPipeline(renderWanted);
+            renderRunning = renderWanted;
+        }
+
+#ifdef MEASURE_TASK_TIMES
+        uint32_t elapsed = micros() - tStart;
+        if (elapsed > maxRoleSwitchTime) maxRoleSwitchTime = elapsed;
+#else
+        (void)tStart;
+#endif
+        // Sleep until the next role or voice mode change
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+
 // Returns an attack envelope that linearly rises from 0 to 1 over 50ms.
 float getAttackEnvelope(uint32_t elapsed) {
     const float attackTime = 0.3f;  // 50 ms in seconds
-    float t = elapsed / (float)SAMPLE_RATE;  // time in seconds
+    float t = elapsed * samplePeriod;  // time in seconds
     if (t >= attackTime) return 1.0f;
     return t / attackTime;
 }
@@ -707,7 +2339,7 @@ float getAttackEnvelope(uint32_t elapsed) {
 // Returns a pitch factor that rises from 0.95 to 1.0 over 50ms.
 float getRisePitchFactor(uint32_t elapsed) {
     const float attackTime = 0.05f;  // 50 ms
-    float t = elapsed / (float)SAMPLE_RATE;
+    float t = elapsed * samplePeriod;
     if (t >= attackTime) return 1.0f;
     // Linear interpolation: at t=0, factor=0.95; at t=attackTime, factor=1.0.
     return 0.95f + 0.05f * (t / attackTime);
@@ -716,50 +2348,651 @@ float getRisePitchFactor(uint32_t elapsed) {
 
 
 // Compute an exponential decay envelope.
-// elapsed is in samples; SAMPLE_RATE is 22050 Hz.
+// elapsed is in samples of the selected sampleRate.
 float getEnvelope(uint32_t elapsed) {
     // Convert samples to seconds.
-    float t = elapsed / (float)SAMPLE_RATE;
+    float t = elapsed * samplePeriod;
     // A decay rate multiplier (adjust to taste; higher value = faster decay).
     return expf(-t * 3.0f);
 }
 
 // Compute a pitch drop factor: start slightly high and drop to 1.0 within ~50ms.
 float getPitchFactor(uint32_t elapsed) {
-    float t = elapsed / (float)SAMPLE_RATE; // time in seconds
+    float t = elapsed * samplePeriod; // time in seconds
     // For instance, start at 1.05 and drop to 1.0 within 50ms.
     float factor = 1.05f - 0.05f * fminf(t / 0.05f, 1.0f);
     return factor;
 }
 
 
-// ------------------------- TIMER ISR FOR AUDIO ----------------------------- //
+// Pitch and modulation are resolved at control rate, once every
+// CONTROL_BLOCK samples: the matrix, one table lookup and a Q16 fine-tune per
+// voice. Per sample, each voice only adds its step to its phase accumulator
+// and ramps its gain.
+const uint8_t CONTROL_BLOCK = 32;
+uint32_t monoStep = 0;  // Local key in non-piano modes (audio ISR only)
+
+// ------------------------- MODULATION -------------------------------------- //
+
+// Routing matrix, evaluated for every voice once per control block so none
+// of it runs per sample. Sources are Q15: the joystick axes and the knobs
+// (around their centre) are bipolar, -1..1; velocity, key pressure and the
+// envelope are unipolar, 0..1. Each route adds amount * source to its
+// destination: pitch and filter cutoff in cents, pulse width in 1/256 of a
+// cycle around a square wave. Amplitude routes are depths in percent: the
+// voice gain is scaled by 1 - depth * (1 - source), with bipolar sources
+// first mapped onto 0..1. Resonance routes likewise add amount percent of
+// full resonance from the source mapped onto 0..1. A route with a via source
+// has its amount scaled by that source (by its magnitude if bipolar), e.g.
+// key pressure setting the vibrato depth. Destinations are smoothed across
+// blocks and the gain is ramped sample by sample, so coarse controls do not
+// step audibly.
+enum ModSource : uint8_t {
+    MOD_SRC_NONE,
+    MOD_SRC_JOY_X,
+    MOD_SRC_JOY_Y,
+    MOD_SRC_KNOB0,
+    MOD_SRC_KNOB1,
+    MOD_SRC_KNOB2,
+    MOD_SRC_KNOB3,
+    MOD_SRC_VELOCITY,
+    MOD_SRC_PRESSURE,
+    MOD_SRC_ENVELOPE,
+    MOD_SRC_LFO1,
+    MOD_SRC_LFO2,
+    MOD_SRC_COUNT
+};
 
-void sampleISR() {
+enum ModDest : uint8_t {
+    MOD_DST_PITCH,
+    MOD_DST_AMPLITUDE,
+    MOD_DST_PULSE_WIDTH,
+    MOD_DST_CUTOFF,
+    MOD_DST_RESONANCE,
+};
+
+struct ModRoute {
+    ModSource source;
+    ModDest dest;
+    int16_t amount;
+    ModSource via;  // MOD_SRC_NONE for a fixed amount
+};
 
-    // Do not generate audio in SENDER mode.
-    if (moduleRole == SENDER) {
+const int32_t MOD_ONE = 32767;
+const uint8_t MOD_SMOOTH_SHIFT = 2;  // One-pole smoothing over ~4 blocks
+const uint8_t MOD_MAX_ROUTES = 8;
+
+ModRoute modRoutes[MOD_MAX_ROUTES] = {
+    { MOD_SRC_JOY_Y,    MOD_DST_PITCH,       100 },   // Bend +-1 semitone
+    { MOD_SRC_KNOB1,    MOD_DST_PULSE_WIDTH, 120 },   // Duty 8/256 to 248/256
+    { MOD_SRC_VELOCITY, MOD_DST_AMPLITUDE,   50 },
+    { MOD_SRC_KNOB1,    MOD_DST_CUTOFF,      3600 },  // +-3 octaves
+    { MOD_SRC_JOY_X,    MOD_DST_RESONANCE,   60 },    // 30% at rest
+    { MOD_SRC_PRESSURE, MOD_DST_CUTOFF,      2400 },
+    { MOD_SRC_LFO1,     MOD_DST_PITCH,       50,  MOD_SRC_PRESSURE },  // Vibrato
+    { MOD_SRC_LFO2,     MOD_DST_AMPLITUDE,   60,  MOD_SRC_JOY_X },     // Tremolo
+};
+
+VoiceMod monoMod;  // Local key in non-piano modes (audio ISR only)
+
+inline bool modBipolar(ModSource source) {
+    return (source >= MOD_SRC_JOY_X && source <= MOD_SRC_KNOB3) || source >= MOD_SRC_LFO1;
+}
+
+// A control position mapped onto -1..1 around its centre
+inline int32_t modCentred(int value, int centre) {
+    int32_t scaled = (value - centre) * MOD_ONE / centre;
+    if (scaled < -MOD_ONE) scaled = -MOD_ONE;
+    if (scaled > MOD_ONE) scaled = MOD_ONE;
+    return scaled;
+}
+
+// LFO bank, advanced once per control block. Adding an LFO costs a phase
+// update per block (and a table lookup per voice if it has per-voice phase),
+// never anything per sample. With perVoice set, each note runs the LFO at its
+// own fixed phase offset so chords shimmer instead of pulsing together.
+enum LfoShape : uint8_t { LFO_SINE, LFO_TRIANGLE, LFO_SAMPLE_HOLD };
+
+struct Lfo {
+    LfoShape shape;
+    uint16_t rate;     // Hundredths of a Hz
+    bool perVoice;     // Sine and triangle only
+    uint32_t phase;
+    int32_t value;     // Q15, at the shared phase
+};
+
+const uint8_t LFO_COUNT = MOD_SRC_LFO2 - MOD_SRC_LFO1 + 1;
+Lfo lfos[LFO_COUNT] = {
+    { LFO_SINE,     550, false, 0, 0 },   // 5.5 Hz vibrato
+    { LFO_TRIANGLE, 400, true,  0, 0 },   // 4 Hz tremolo
+};
+
+static_assert(FFT_SIZE == 256, "LFO sine reads the 256-point analysis table");
+
+// Q15 value of a sine or triangle LFO at a phase
+int32_t lfoWave(LfoShape shape, uint32_t phase) {
+    if (shape == LFO_SINE) {
+        uint8_t index = phase >> 24;
+        return (index < 128) ? fftSine[index] : -fftSine[index - 128];
+    }
+    int32_t ramp = phase >> 16;  // 0..65535
+    return (ramp < 32768) ? ramp * 2 - MOD_ONE : (65535 - ramp) * 2 - MOD_ONE;
+}
+
+// Advance every LFO by one control block
+void advanceLfos() {
+    for (uint8_t l = 0; l < LFO_COUNT; l++) {
+        Lfo &lfo = lfos[l];
+        uint32_t step = (uint64_t)lfo.rate * CONTROL_BLOCK * 4294967296ULL / (100ULL * sampleRate);
+        uint32_t previous = lfo.phase;
+        lfo.phase += step;
+        if (lfo.shape == LFO_SAMPLE_HOLD) {
+            // New random level once per cycle
+            if (lfo.phase < previous) lfo.value = (int32_t)(nextNoise() >> 16) - 32768;
+        }
+        else {
+            lfo.value = lfoWave(lfo.shape, lfo.phase);
+        }
+    }
+}
+
+// LFO sources for one voice, offset by its note where perVoice is set
+void voiceLfoSources(int32_t* sources, uint8_t note) {
+    for (uint8_t l = 0; l < LFO_COUNT; l++) {
+        const Lfo &lfo = lfos[l];
+        if (lfo.perVoice && lfo.shape != LFO_SAMPLE_HOLD) {
+            sources[MOD_SRC_LFO1 + l] = lfoWave(lfo.shape, lfo.phase + note * 0x9E3779B9u);
+        }
+        else {
+            sources[MOD_SRC_LFO1 + l] = lfo.value;
+        }
+    }
+}
+
+// Sources shared by every voice, read once per block
+void readModSources(int32_t* sources) {
+    sources[MOD_SRC_NONE] = 0;
+    sources[MOD_SRC_JOY_X] = modCentred(joyX12Val, 6);
+    sources[MOD_SRC_JOY_Y] = modCentred(joyY12Val, 6);
+    sources[MOD_SRC_KNOB0] = modCentred(sysState.knob0.getRotation(), 4);
+    sources[MOD_SRC_KNOB1] = modCentred(sysState.knob1.getRotation(), 4);
+    sources[MOD_SRC_KNOB2] = modCentred(sysState.knob2.getRotation(), 4);
+    sources[MOD_SRC_KNOB3] = modCentred(sysState.knob3.getRotation(), 4);
+    advanceLfos();
+}
+
+// Evaluate the matrix for one voice and move its destinations towards the result
+void updateVoiceMod(VoiceMod &mod, const int32_t* sources) {
+    int32_t pitch = 0;
+    int32_t pulseWidth = 128;
+    int32_t cutoff = 0;
+    int32_t resonance = 0;
+    int32_t gain = MOD_ONE;
+    for (uint8_t r = 0; r < MOD_MAX_ROUTES; r++) {
+        const ModRoute &route = modRoutes[r];
+        if (route.source == MOD_SRC_NONE) continue;
+        int32_t value = sources[route.source];
+        int32_t amount = route.amount;
+        if (route.via != MOD_SRC_NONE) {
+            int32_t scale = sources[route.via];
+            if (scale < 0) scale = -scale;
+            amount = (amount * scale) >> 15;
+        }
+        int32_t delta = (amount * value) >> 15;
+        switch (route.dest) {
+            case MOD_DST_PITCH:       pitch += delta; break;
+            case MOD_DST_PULSE_WIDTH: pulseWidth += delta; break;
+            case MOD_DST_CUTOFF:      cutoff += delta; break;
+            case MOD_DST_AMPLITUDE: {
+                int32_t unipolar = modBipolar(route.source) ? (value + MOD_ONE) / 2 : value;
+                gain = (gain * (MOD_ONE - amount * (MOD_ONE - unipolar) / 100)) >> 15;
+                break;
+            }
+            case MOD_DST_RESONANCE: {
+                int32_t unipolar = modBipolar(route.source) ? (value + MOD_ONE) / 2 : value;
+                resonance += amount * unipolar / 100;
+                break;
+            }
+        }
+    }
+    if (pulseWidth < 8) pulseWidth = 8;
+    if (pulseWidth > 248) pulseWidth = 248;
+    if (gain < 0) gain = 0;
+    if (gain > MOD_ONE) gain = MOD_ONE;
+    if (resonance < 0) resonance = 0;
+    if (resonance > MOD_ONE) resonance = MOD_ONE;
+
+    if (!mod.ready) {
+        mod.pitch = pitch;
+        mod.pulseWidth = pulseWidth;
+        mod.cutoff = cutoff;
+        mod.resonance = resonance;
+        mod.gain = gain;
+        mod.gainStep = 0;
+        mod.ready = true;
         return;
     }
-#ifdef MEASURE_TASK_TIMES
-    uint32_t startISR = DWT->CYCCNT;
+    mod.pitch += (pitch - mod.pitch) >> MOD_SMOOTH_SHIFT;
+    mod.pulseWidth += (pulseWidth - mod.pulseWidth) >> MOD_SMOOTH_SHIFT;
+    mod.cutoff += (cutoff - mod.cutoff) >> MOD_SMOOTH_SHIFT;
+    mod.resonance += (resonance - mod.resonance) >> MOD_SMOOTH_SHIFT;
+    int32_t gainTarget = mod.gain + ((gain - mod.gain) >> MOD_SMOOTH_SHIFT);
+    mod.gainStep = (gainTarget - mod.gain) / CONTROL_BLOCK;
+}
+
+// Envelope source of a voice: the amplitude envelope of the piano and rise
+// modes, a plain gate otherwise
+int32_t envelopeSource(WaveformType waveform, uint32_t elapsed) {
+    if (waveform == PIANO) return (int32_t)(getEnvelope(elapsed) * MOD_ONE);
+    if (waveform == RISE) return (int32_t)(getAttackEnvelope(elapsed) * MOD_ONE);
+    return MOD_ONE;
+}
+
+// Apply a voice's gain to one sample (-128..127 nominal) and advance the
+// ramp. The result is on the Q15 scale of the mix, so the gain's low bits
+// are kept for the 12-bit DAC instead of being truncated to 8 bits. Every
+// voice is mixed at the same fixed level, MIX_HEADROOM_SHIFT * 6 dB below
+// full scale, so a note is as loud in a chord as on its own; the limiter
+// catches the peaks of larger chords.
+const uint8_t MIX_HEADROOM_SHIFT = 1;
+const uint8_t MIX_GAIN_SHIFT = 15 - 8 + MIX_HEADROOM_SHIFT;
+
+inline int applyGain(int sample, VoiceMod &mod) {
+    sample = (sample * mod.gain) >> MIX_GAIN_SHIFT;
+    mod.gain += mod.gainStep;
+    return sample;
+}
+
+// The piano and rise voices compute their envelope in float and keep this
+// many bits more than the 8-bit oscillators, so quiet decays stay smooth
+const uint8_t ENV_SAMPLE_SHIFT = 4;
+const float ENV_SAMPLE_SCALE = 127.0f * (1 << ENV_SAMPLE_SHIFT);
+
+// Constant-power pan law, from the analysis sine table
+static_assert(FFT_SIZE / 4 == PAN_RIGHT, "Pan positions span a quarter sine period");
+
+inline void setPan(VoiceMod &mod, uint8_t position) {
+    mod.panLeft = fftSine[position + FFT_SIZE / 4];  // cos
+    mod.panRight = fftSine[position];                // sin
+}
+
+// Add a voice to the stereo mix. A resonant filter can take a sample past
+// 16 bits, so the products are 64-bit (one SMULL each on the M4).
+inline void panVoice(int sample, const VoiceMod &mod, int32_t &left, int32_t &right) {
+    left += ((int64_t)sample * mod.panLeft) >> 15;
+    right += ((int64_t)sample * mod.panRight) >> 15;
+}
+
+// Each voice of the oscillator modes runs through its own resonant low-pass
+// (lib/SVF). The cutoff tracks the note, FILTER_KEY_OFFSET above it with the
+// matrix cutoff added, so a chord keeps the same tone across the keyboard.
+// Coefficients are recomputed at control rate and only when the cutoff or the
+// resonance has moved; the piano and rise modes are sines and skip the filter.
+const int32_t FILTER_KEY_OFFSET = 3600;  // Cents above the note
+SVF monoFilter;  // Local key in non-piano modes (audio ISR only)
+
+inline bool waveformFiltered(WaveformType waveform) {
+    return waveform != PIANO && waveform != RISE;
+}
+
+inline void tuneFilter(SVF &filter, int note, const VoiceMod &mod) {
+    SVF_Tune(filter, pitchStep(note, mod.pitch + FILTER_KEY_OFFSET + mod.cutoff), mod.resonance);
+}
+
+
+// ------------------------- EFFECTS ----------------------------------------- //
+
+// Master bus effects: chorus, feedback delay and reverb, in that order, chosen
+// by preset with the joystick button. The audio ISR works through the bus in
+// blocks of CONTROL_BLOCK samples: it stores the dry mix in one half of
+// fxDry and plays the same half of fxWet, and when a dry half is full it
+// wakes effectsTask, which copies it to fxWet and processes it there while
+// the other half plays. The effects cost one task wake-up per block and
+// nothing per sample in the interrupt, for two blocks of latency (2.9 ms at
+// 22050 Hz). A block that is not finished in time is not read: that block
+// plays dry and is counted in fxLateBlocks, and a dry block that arrives
+// while the task is still busy skips the effects. With the effects off the
+// ISR skips the buffers. Bus frames are stereo Q15; each
+// effect takes the mid signal and adds its output to both channels.
+
+// Delay lines share one static arena. Lengths are in samples, so delay times
+// shrink at higher sample rates; times in ms are clamped to the line. The
+// lengths are literals so -D FX_REPORT_ARENA can print the layout at build
+// time; initEffects() prints the same at boot.
+#define FX_DELAY_SAMPLES    8192   // 371 ms at 22050 Hz
+#define FX_CHORUS_SAMPLES   1024
+#define FX_COMB_SAMPLES     2468   // Reverb, four parallel combs
+#define FX_ALLPASS_SAMPLES  498    // Reverb, two allpasses in series
+#define FX_ARENA_BUDGET     32768  // Bytes, half of the L432's 64 KB SRAM
+
+#ifdef FX_REPORT_ARENA
+#define FX_STRINGIFY(x) #x
+#define FX_STR(x) FX_STRINGIFY(x)
+#pragma message("Effects arena (int16 samples): delay " FX_STR(FX_DELAY_SAMPLES) \
+                ", chorus " FX_STR(FX_CHORUS_SAMPLES) ", reverb combs " FX_STR(FX_COMB_SAMPLES) \
+                ", reverb allpasses " FX_STR(FX_ALLPASS_SAMPLES) "; budget " FX_STR(FX_ARENA_BUDGET) " B")
 #endif
-    // Transposition multipliers for non-piano modes.
-    const float transposeMultipliers[9] = {
-        0.7937098f, 0.8409038f, 0.8909039f, 0.943877f,
-        1.000000f,  1.0594600f, 1.1224555f, 1.1891967f, 1.2599063f
-    };
 
-    // Update octave from knob2.
-    int knobOctave = sysState.knob2.getRotation();
-    if (knobOctave < 0) knobOctave = 0;
-    if (knobOctave > 8) knobOctave = 8;
-    moduleOctave = knobOctave;
+// Reverb line lengths: Freeverb's tunings halved for 22050 Hz, mutually prime
+const uint16_t REVERB_COMB_LENGTHS[] = { 557, 593, 641, 677 };
+const uint16_t REVERB_ALLPASS_LENGTHS[] = { 277, 221 };
+const uint8_t REVERB_COMBS = sizeof(REVERB_COMB_LENGTHS) / sizeof(REVERB_COMB_LENGTHS[0]);
+const uint8_t REVERB_ALLPASSES = sizeof(REVERB_ALLPASS_LENGTHS) / sizeof(REVERB_ALLPASS_LENGTHS[0]);
+static_assert(557 + 593 + 641 + 677 == FX_COMB_SAMPLES, "FX_COMB_SAMPLES must match the comb lengths");
+static_assert(277 + 221 == FX_ALLPASS_SAMPLES, "FX_ALLPASS_SAMPLES must match the allpass lengths");
+
+const uint32_t FX_ARENA_SAMPLES = FX_DELAY_SAMPLES + FX_CHORUS_SAMPLES + FX_COMB_SAMPLES + FX_ALLPASS_SAMPLES;
+static_assert(FX_ARENA_SAMPLES * sizeof(int16_t) <= FX_ARENA_BUDGET,
+              "Effects delay lines exceed FX_ARENA_BUDGET; shorten them or raise the budget");
+
+int16_t fxArena[FX_ARENA_SAMPLES];
+
+struct DelayLine {
+    int16_t* buffer;
+    uint16_t length;
+    uint16_t pos;       // Next write
+};
+
+// Carve the lines out of the arena in order
+struct FxArenaCursor {
+    uint32_t used = 0;
+    DelayLine take(uint16_t length) {
+        DelayLine line = { &fxArena[used], length, 0 };
+        used += length;
+        return line;
+    }
+};
+
+DelayLine fxDelayLine;
+DelayLine fxChorusLine;
+DelayLine fxCombs[REVERB_COMBS];
+DelayLine fxAllpasses[REVERB_ALLPASSES];
+int32_t fxCombDamp[REVERB_COMBS];  // One-pole state in each comb's feedback
+
+void initEffects() {
+    FxArenaCursor cursor;
+    fxDelayLine = cursor.take(FX_DELAY_SAMPLES);
+    fxChorusLine = cursor.take(FX_CHORUS_SAMPLES);
+    for (uint8_t c = 0; c < REVERB_COMBS; c++) fxCombs[c] = cursor.take(REVERB_COMB_LENGTHS[c]);
+    for (uint8_t a = 0; a < REVERB_ALLPASSES; a++) fxAllpasses[a] = cursor.take(REVERB_ALLPASS_LENGTHS[a]);
+    Serial.print("Effects arena (samples): delay ");
+    Serial.print(FX_DELAY_SAMPLES);
+    Serial.print(", chorus ");
+    Serial.print(FX_CHORUS_SAMPLES);
+    Serial.print(", reverb combs ");
+    Serial.print(FX_COMB_SAMPLES);
+    Serial.print(", reverb allpasses ");
+    Serial.print(FX_ALLPASS_SAMPLES);
+    Serial.print("; ");
+    Serial.print(cursor.used * sizeof(int16_t));
+    Serial.print(" of ");
+    Serial.print(FX_ARENA_BUDGET);
+    Serial.println(" B");
+}
+
+// Effect settings; gains are Q15
+const uint16_t FX_CHORUS_RATE = 80;          // Hundredths of a Hz
+const uint32_t FX_CHORUS_DELAY_US = 12000;   // Centre of the sweep
+const uint32_t FX_CHORUS_DEPTH_US = 3000;
+const int32_t FX_CHORUS_MIX = 16384;
+const uint32_t FX_DELAY_MS = 250;
+const int32_t FX_DELAY_FEEDBACK = 14746;     // 0.45
+const int32_t FX_DELAY_MIX = 11469;          // 0.35
+const int32_t FX_REVERB_FEEDBACK = 27525;    // 0.84, room size
+const int32_t FX_REVERB_DAMP = 6554;         // 0.2, high-frequency loss per pass
+const int32_t FX_REVERB_MIX = 9830;          // 0.3
+
+inline int16_t fxSaturate(int32_t sample) {
+    if (sample > 32767) return 32767;
+    if (sample < -32768) return -32768;
+    return sample;
+}
+
+struct StereoFrame {
+    int16_t left;
+    int16_t right;
+};
+
+inline int32_t fxMid(const StereoFrame &frame) {
+    return (frame.left + frame.right) >> 1;
+}
+
+inline void fxAddWet(StereoFrame &frame, int32_t wet) {
+    frame.left = fxSaturate(frame.left + wet);
+    frame.right = fxSaturate(frame.right + wet);
+}
+
+// Sample written delay samples ago (1..length)
+inline int32_t delayTap(const DelayLine &line, uint32_t delay) {
+    int32_t index = (int32_t)line.pos - (int32_t)delay;
+    if (index < 0) index += line.length;
+    return line.buffer[index];
+}
+
+inline void delayWrite(DelayLine &line, int32_t sample) {
+    line.buffer[line.pos] = fxSaturate(sample);
+    if (++line.pos == line.length) line.pos = 0;
+}
+
+// Delay in samples (Q8) for a time in us, kept inside a line
+uint32_t fxDelayQ8(uint32_t us, const DelayLine &line) {
+    uint32_t delay = (uint64_t)us * sampleRate * 256 / 1000000;
+    uint32_t limit = (uint32_t)(line.length - 2) << 8;
+    return delay > limit ? limit : delay;
+}
+
+// Chorus: one voice read from a delay swept by a sine, linearly interpolated;
+// the sweep is evaluated at the block ends and ramped in between
+void processChorus(StereoFrame* block) {
+    static uint32_t lfoPhase = 0;
+    uint32_t centre = fxDelayQ8(FX_CHORUS_DELAY_US, fxChorusLine);
+    int32_t depth = fxDelayQ8(FX_CHORUS_DEPTH_US, fxChorusLine);
+    int32_t start = centre + ((depth * lfoWave(LFO_SINE, lfoPhase)) >> 15);
+    lfoPhase += (uint64_t)FX_CHORUS_RATE * CONTROL_BLOCK * 4294967296ULL / (100ULL * sampleRate);
+    int32_t end = centre + ((depth * lfoWave(LFO_SINE, lfoPhase)) >> 15);
+    int32_t step = (end - start) / CONTROL_BLOCK;
+
+    int32_t delay = start;
+    for (uint8_t i = 0; i < CONTROL_BLOCK; i++) {
+        delayWrite(fxChorusLine, fxMid(block[i]));
+        uint32_t whole = delay >> 8;
+        int32_t frac = delay & 0xFF;
+        int32_t a = delayTap(fxChorusLine, whole + 1);
+        int32_t b = delayTap(fxChorusLine, whole + 2);
+        int32_t wet = a + (((b - a) * frac) >> 8);
+        fxAddWet(block[i], (wet * FX_CHORUS_MIX) >> 15);
+        delay += step;
+    }
+}
+
+void processDelay(StereoFrame* block) {
+    uint32_t delay = (fxDelayQ8(FX_DELAY_MS * 1000, fxDelayLine) >> 8) + 1;
+    for (uint8_t i = 0; i < CONTROL_BLOCK; i++) {
+        int32_t echo = delayTap(fxDelayLine, delay);
+        delayWrite(fxDelayLine, fxMid(block[i]) + ((echo * FX_DELAY_FEEDBACK) >> 15));
+        fxAddWet(block[i], (echo * FX_DELAY_MIX) >> 15);
+    }
+}
+
+// Schroeder reverb: parallel damped combs into series allpasses (gain 0.5)
+void processReverb(StereoFrame* block) {
+    for (uint8_t i = 0; i < CONTROL_BLOCK; i++) {
+        int32_t input = fxMid(block[i]) >> 4;
+        int32_t wet = 0;
+        for (uint8_t c = 0; c < REVERB_COMBS; c++) {
+            DelayLine &comb = fxCombs[c];
+            int32_t out = comb.buffer[comb.pos];
+            fxCombDamp[c] += ((out - fxCombDamp[c]) * (32768 - FX_REVERB_DAMP)) >> 15;
+            delayWrite(comb, input + ((fxCombDamp[c] * FX_REVERB_FEEDBACK) >> 15));
+            wet += out;
+        }
+        for (uint8_t a = 0; a < REVERB_ALLPASSES; a++) {
+            DelayLine &allpass = fxAllpasses[a];
+            int32_t delayed = allpass.buffer[allpass.pos];
+            delayWrite(allpass, wet + (delayed >> 1));
+            wet = delayed - wet;
+        }
+        fxAddWet(block[i], (wet * FX_REVERB_MIX) >> 15);
+    }
+}
+
+// Double buffers between the audio ISR and effectsTask. The ISR only writes
+// fxDry and only reads a half of fxWet the task has finished; the task only
+// writes fxWet, and only a half the ISR is not playing.
+StereoFrame fxDry[2][CONTROL_BLOCK];
+StereoFrame fxWet[2][CONTROL_BLOCK];
+volatile bool fxReady[2] = { false, false };  // fxWet half processed, safe to play
+volatile bool fxBusy = false;                 // effectsTask has a half in hand
+volatile uint8_t fxPending = 0;               // That half
+volatile uint32_t fxLateBlocks = 0;
+TaskHandle_t effectsHandle = NULL;
+
+// Store a dry bus frame and return the one to play (audio ISR only)
+inline StereoFrame fxExchange(const StereoFrame &dry, EffectsPreset preset) {
+    static uint8_t half = 0;
+    static uint8_t pos = 0;
+    static bool playWet = false;  // Decided once per block
+    static bool wasActive = false;
+    static bool handedOver[2] = { false, false };  // Last fill of each half went to the task
+    bool active = (preset != FX_OFF);
+
+    if (pos == 0) {
+        // A half the task finished after it was due is stale by now
+        playWet = active && handedOver[half] && fxReady[half];
+        // A block that was due while the effects ran and is not ready plays dry
+        if (active && wasActive && !playWet) fxLateBlocks++;
+        wasActive = active;
+    }
+    StereoFrame out = playWet ? fxWet[half][pos] : dry;
+    fxDry[half][pos] = dry;
+    if (++pos == CONTROL_BLOCK) {
+        pos = 0;
+        fxReady[half] = false;
+        handedOver[half] = active && effectsHandle != NULL && !fxBusy;
+        if (handedOver[half]) {
+            fxPending = half;
+            fxBusy = true;
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(effectsHandle, &woken);
+            portYIELD_FROM_ISR(woken);
+        }
+        half ^= 1;
+    }
+    return out;
+}
+
+void effectsTask(void * pvParameters) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        TASK_START();
+        uint8_t half = fxPending;
+        StereoFrame* block = fxWet[half];
+        for (uint8_t i = 0; i < CONTROL_BLOCK; i++) block[i] = fxDry[half][i];
+        EffectsPreset preset = currentEffects;
+        if (preset == FX_CHORUS || preset == FX_ALL) processChorus(block);
+        if (preset == FX_DELAY || preset == FX_ALL) processDelay(block);
+        if (preset == FX_REVERB || preset == FX_ALL) processReverb(block);
+        fxReady[half] = true;
+        fxBusy = false;
+        TASK_END(maxEffectsTime);
+    }
+}
+
+const char* effectsName(EffectsPreset preset) {
+    switch (preset) {
+        case FX_CHORUS: return "chorus";
+        case FX_DELAY:  return "delay";
+        case FX_REVERB: return "reverb";
+        case FX_ALL:    return "chorus+delay+reverb";
+        default:        return "off";
+    }
+}
+
+
+// ------------------------- TIMER ISR FOR AUDIO ----------------------------- //
+
+void updateVoices(const ControlSnapshot &controls) {
+    int32_t sources[MOD_SRC_COUNT];
+    readModSources(sources);
+
+    // Knob 0 transposes the local key by -4..+4 semitones
+    uint8_t note = currentNote;
+    if (note == NO_NOTE) {
+        monoStep = 0;
+        monoMod.ready = false;
+        SVF_Reset(monoFilter);
+    }
+    else {
+        sources[MOD_SRC_VELOCITY] = MIDI_KEY_VELOCITY * MOD_ONE / 127;
+        sources[MOD_SRC_PRESSURE] = 0;
+        sources[MOD_SRC_ENVELOPE] = MOD_ONE;
+        voiceLfoSources(sources, note);
+        updateVoiceMod(monoMod, sources);
+        int transpose = sysState.knob0.getRotation() - 4;
+        // A new pan position for each key press
+        static uint8_t pannedNote = NO_NOTE;
+        static uint8_t monoPan = PAN_CENTRE;
+        if (note != pannedNote) {
+            monoPan = panPosition(note + transpose, moduleOctave);
+            pannedNote = note;
+        }
+        setPan(monoMod, monoPan);
+        monoStep = pitchStep(note + transpose, monoMod.pitch);
+        if (waveformFiltered(controls.waveform)) tuneFilter(monoFilter, note + transpose, monoMod);
+    }
+
+    // Piano and rise notes glide onto pitch over their first 50 ms
+    for (uint8_t i = 0; i < activeNoteCount; i++) {
+        ActiveNote &voice = activeNotes[i];
+        sources[MOD_SRC_VELOCITY] = voice.velocity * MOD_ONE / 127;
+        sources[MOD_SRC_PRESSURE] = voice.pressure * MOD_ONE / 127;
+        sources[MOD_SRC_ENVELOPE] = envelopeSource(controls.waveform, voice.elapsed);
+        voiceLfoSources(sources, voice.note);
+        updateVoiceMod(voice.mod, sources);
+        setPan(voice.mod, voice.pan);
+        uint32_t step = pitchStep(voice.note, voice.mod.pitch);
+        if (controls.waveform == PIANO) {
+            step = (uint32_t)(step * getPitchFactor(voice.elapsed));
+        }
+        else if (controls.waveform == RISE) {
+            step = (uint32_t)(step * getRisePitchFactor(voice.elapsed));
+        }
+        voice.step = step;
+        if (waveformFiltered(controls.waveform)) tuneFilter(voice.filter, voice.note, voice.mod);
+    }
+}
+
+// Soft-knee peak limiter on the dry mix. It needs no lookahead: the block is
+// rendered before it is played, so its gain comes from the peak of the block
+// itself. Gain reduction eases in from LIMIT_KNEE_DB below the ceiling and
+// holds peaks at LIMIT_CEILING_DB above it, takes effect at once when a
+// louder block arrives and recovers over about 64 blocks (93 ms at 22050 Hz)
+// afterwards, ramping sample by sample within each block. The curve costs a
+// log and a power per block, and only while a peak is in the knee.
+const float LIMIT_CEILING_DB = -3.0f;
+const float LIMIT_KNEE_DB = 6.0f;
+const int32_t LIMIT_KNEE_START = 16423;   // Q15 peak at -6 dBFS, ceiling - knee / 2
+const uint8_t LIMIT_RELEASE_SHIFT = 6;    // Release moves 1/64 of the way per block
+int32_t limiterGain = MOD_ONE;            // Q15 (audio ISR only)
+volatile int32_t minLimiterGain = MOD_ONE;  // Deepest reduction so far, for the debug monitor
+
+int32_t limiterTarget(int32_t peak) {
+    if (peak <= LIMIT_KNEE_START) return MOD_ONE;
+    float input = 20.0f * log10f(peak / 32767.0f);
+    float over = input - (LIMIT_CEILING_DB - LIMIT_KNEE_DB / 2);
+    float output = (over < LIMIT_KNEE_DB) ? input - over * over / (2 * LIMIT_KNEE_DB) : LIMIT_CEILING_DB;
+    return (int32_t)(32767.0f * powf(10.0f, (output - input) / 20.0f));
+}
+
+// Mix every sounding voice into one stereo sample (audio ISR only)
+inline void mixVoices(const ControlSnapshot &controls, int32_t &mixLeft, int32_t &mixRight) {
+    // Remote notes play in the octave of the module that sent them;
+    // moduleOctave (knob 2) applies to this module's own keys.
 
+    mixLeft = 0;
+    mixRight = 0;
     // For piano mode, process each active note with its own envelope and pitch drop.
-    if (currentWaveform == PIANO) {
-        int32_t mixSum = 0;
-        uint8_t voices = 0;
+    if (controls.waveform == PIANO) {
         // Iterate over active notes, and remove those that have decayed completely.
         for (uint8_t i = 0; i < activeNoteCount; ) {
             activeNotes[i].elapsed++;
@@ -774,46 +3007,26 @@ void sampleISR() {
                 // Do not increment i, as a new note is now at position i.
                 continue;
             }
-            float pitchFactor = getPitchFactor(activeNotes[i].elapsed);
-            uint32_t noteStep = activeNotes[i].stepSize;
-            if (moduleOctave > 4) {
-                noteStep <<= (moduleOctave - 4);
-            } else if (moduleOctave < 4) {
-                noteStep >>= (4 - moduleOctave);
-            }
-            uint32_t modifiedStep = (uint32_t)(noteStep * pitchFactor);
-            activeNotes[i].phaseAcc += modifiedStep;
+            activeNotes[i].phaseAcc += activeNotes[i].step;
     
             uint8_t phase = activeNotes[i].phaseAcc >> 24;
             float angle = (phase / 256.0f) * 6.28318530718f; // 2π radians
-            int sample = (int)(sinf(angle) * 127.0f);
-            sample = (int)(sample * env);
-            mixSum += sample;
-            voices++;
+            int sample = (int)(sinf(angle) * env * ENV_SAMPLE_SCALE);
+            sample = applyGain(sample, activeNotes[i].mod) >> ENV_SAMPLE_SHIFT;
+            panVoice(sample, activeNotes[i].mod, mixLeft, mixRight);
+            LATENCY_NOTE_RENDERED(activeNotes[i]);
             i++;
         }
-        int normalizedSample = (voices > 0) ? mixSum / voices : 0;
-        int volume = sysState.knob3.getRotation();
-        if (volume < 0) volume = 0;
-        if (volume > 8) volume = 8;
-        int scaledSample = (normalizedSample * volume) / 8;
-        int finalOutput = scaledSample + 128;
-        if (finalOutput < 0) finalOutput = 0;
-        if (finalOutput > 255) finalOutput = 255;
-        analogWrite(OUTR_PIN, finalOutput);
-    } else if (currentWaveform == RISE) {
-        int32_t mixSum = 0;
-        uint8_t voices = 0;
+    } else if (controls.waveform == RISE) {
         for (uint8_t i = 0; i < activeNoteCount; ) {
             activeNotes[i].elapsed++;
             // Get rising envelope and pitch factor.
             float env = getAttackEnvelope(activeNotes[i].elapsed);
-            float pitchFactor = getRisePitchFactor(activeNotes[i].elapsed);
             
             // Remove note if it has decayed (or if, for some reason, envelope remains 0 for too long)
             // (In RISE mode we expect the envelope to reach 1 quickly, so we may not remove it here.)
             // For example, if a note remains at 0 for > 100ms, remove it.
-            if (activeNotes[i].elapsed > SAMPLE_RATE / 10 && env < 0.01f) {
+            if (activeNotes[i].elapsed > sampleRate / 10 && env < 0.01f) {
                 for (uint8_t j = i; j < activeNoteCount - 1; j++) {
                     activeNotes[j] = activeNotes[j + 1];
                 }
@@ -821,78 +3034,102 @@ void sampleISR() {
                 continue;
             }
             
-            // Apply octave scaling.
-            uint32_t noteStep = activeNotes[i].stepSize;
-            if (moduleOctave > 4) {
-                noteStep <<= (moduleOctave - 4);
-            } else if (moduleOctave < 4) {
-                noteStep >>= (4 - moduleOctave);
-            }
-            
-            // Apply the pitch rise factor to the note's step size.
-            uint32_t modifiedStep = (uint32_t)(noteStep * pitchFactor);
-            activeNotes[i].phaseAcc += modifiedStep;
+            // The step already includes the pitch rise (control rate)
+            activeNotes[i].phaseAcc += activeNotes[i].step;
     
             // Use a sine oscillator to generate the tone.
             uint8_t phase = activeNotes[i].phaseAcc >> 24;
             float angle = (phase / 256.0f) * 6.28318530718f;
-            int sample = (int)(sinf(angle) * 127.0f);
     
             // Apply the rising amplitude envelope.
-            sample = (int)(sample * env);
-            mixSum += sample;
-            voices++;
+            int sample = (int)(sinf(angle) * env * ENV_SAMPLE_SCALE);
+            sample = applyGain(sample, activeNotes[i].mod) >> ENV_SAMPLE_SHIFT;
+            panVoice(sample, activeNotes[i].mod, mixLeft, mixRight);
+            LATENCY_NOTE_RENDERED(activeNotes[i]);
             i++;
         }
-        int normalizedSample = (voices > 0) ? mixSum / voices : 0;
-        int volume = sysState.knob3.getRotation();
-        if (volume < 0) volume = 0;
-        if (volume > 8) volume = 8;
-        int scaledSample = (normalizedSample * volume) / 8;
-        int finalOutput = scaledSample + 128;
-        if (finalOutput < 0) finalOutput = 0;
-        if (finalOutput > 255) finalOutput = 255;
-        analogWrite(OUTR_PIN, finalOutput);
     } 
     else {
-        // Non-PIANO mode processing as before.
-        int transposition = sysState.knob0.getRotation();
-        uint32_t effectiveStep = currentStepSize;
-        effectiveStep = effectiveStep * transposeMultipliers[transposition];
-        effectiveStep += ((int32_t)(joyY12Val - 6) * (effectiveStep / 100));
-    
-        uint32_t scaledEffectiveStep = effectiveStep;
-        if (moduleOctave > 4) {
-            scaledEffectiveStep <<= (moduleOctave - 4);
-        } else if (moduleOctave < 4) {
-            scaledEffectiveStep >>= (4 - moduleOctave);
+        // Non-PIANO mode: the local key (transposed and bent at control
+        // rate) plus the remote notes. With no key held the local voice is
+        // skipped; its waveform would sit at a constant offset.
+        if (monoStep != 0) {
+            phaseAcc += monoStep;
+            int mainSample = SVF_Process(monoFilter, computeWaveform(phaseAcc, controls.waveform, monoMod.pulseWidth));
+            panVoice(applyGain(mainSample, monoMod), monoMod, mixLeft, mixRight);
         }
-    
-        phaseAcc += scaledEffectiveStep;
-        int mainSample = computeWaveform(phaseAcc);
-    
-        int32_t mixSum = mainSample;
-        uint8_t voices = 1;
         for (uint8_t i = 0; i < activeNoteCount; i++) {
-            uint32_t noteStep = activeNotes[i].stepSize;
-            if (moduleOctave > 4) {
-                noteStep <<= (moduleOctave - 4);
-            } else if (moduleOctave < 4) {
-                noteStep >>= (4 - moduleOctave);
-            }
-            activeNotes[i].phaseAcc += noteStep;
-            mixSum += computeWaveform(activeNotes[i].phaseAcc);
-            voices++;
-        }
-        int normalizedSample = mixSum / voices;
-        int volume = sysState.knob3.getRotation();
-        if (volume < 0) volume = 0;
-        if (volume > 8) volume = 8;
-        int scaledSample = (normalizedSample * volume) / 8;
-        int finalOutput = scaledSample + 128;
-        if (finalOutput < 0) finalOutput = 0;
-        if (finalOutput > 255) finalOutput = 255;
-        analogWrite(OUTR_PIN, finalOutput);
+            ActiveNote &voice = activeNotes[i];
+            voice.phaseAcc += voice.step;
+            int sample = computeWaveform(voice.phaseAcc, controls.waveform, voice.mod.pulseWidth);
+            panVoice(applyGain(SVF_Process(voice.filter, sample), voice.mod), voice.mod, mixLeft, mixRight);
+            LATENCY_NOTE_RENDERED(activeNotes[i]);
+        }
+    }
+}
+
+// Master bus for one limited frame: effects (a block behind when enabled),
+// then volume (0-8) and the DAC quantiser. Both channels 0-4095 (audio ISR only)
+inline uint32_t outputFrame(const StereoFrame &dry, const ControlSnapshot &controls,
+                            int volume, DitherMode dither) {
+    StereoFrame bus = fxExchange(dry, controls.effects);
+    uint16_t left = Dither_Quantise(outputDither[0], (bus.left * volume) >> 3, dither);
+    uint16_t right = Dither_Quantise(outputDither[1], (bus.right * volume) >> 3, dither);
+    captureSample((left + right) >> (DITHER_DAC_BITS - 7));
+    return AudioDMA_Frame(left, right);
+}
+
+// Fill one block of the DAC ring (DMA interrupt). A block is one control
+// block, so the voices and their modulation are updated once at the start.
+static_assert(AUDIO_BLOCK_FRAMES == CONTROL_BLOCK, "One DMA block per control block");
+
+void audioBlockISR(uint32_t* frames, uint32_t count) {
+    if (audioWakePending) {
+        uint32_t latency = micros() - audioWakeRequestedAt;
+        lastAudioWakeLatency = latency;
+        if (latency > maxAudioWakeLatency) maxAudioWakeLatency = latency;
+        audioWakePending = false;
+    }
+
+    // Lock-free read of the controls; keep the last good copy if it fails
+    static ControlSnapshot controls;
+    ControlSnapshot fresh;
+    if (controlState.tryRead(fresh)) controls = fresh;
+
+    // Do not generate audio in SENDER mode, unless rendering its own keys.
+    if (controls.role == SENDER && controls.voiceMode == VOICES_CENTRAL) {
+        for (uint32_t n = 0; n < count; n++) frames[n] = AUDIO_SILENT_FRAME;
+        return;
+    }
+#ifdef MEASURE_TASK_TIMES
+    uint32_t startISR = DWT->CYCCNT;
+#endif
+    updateVoices(controls);
+
+    // Mix the block, then limit it from its own peak
+    static int32_t mix[AUDIO_BLOCK_FRAMES][2];
+    int32_t peak = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        mixVoices(controls, mix[n][0], mix[n][1]);
+        if (abs(mix[n][0]) > peak) peak = abs(mix[n][0]);
+        if (abs(mix[n][1]) > peak) peak = abs(mix[n][1]);
+    }
+    int32_t target = limiterTarget(peak);
+    if (target < limiterGain) limiterGain = target;  // Attack at once, from the first sample
+    if (target < minLimiterGain) minLimiterGain = target;
+    int32_t gain = limiterGain;
+    limiterGain += (target - limiterGain) >> LIMIT_RELEASE_SHIFT;
+    int32_t gainStep = (limiterGain - gain) / (int32_t)count;
+
+    int volume = sysState.knob3.getRotation();
+    if (volume < 0) volume = 0;
+    if (volume > 8) volume = 8;
+    DitherMode dither = ditherMode;
+    for (uint32_t n = 0; n < count; n++) {
+        StereoFrame dry = { fxSaturate(((int64_t)mix[n][0] * gain) >> 15),
+                            fxSaturate(((int64_t)mix[n][1] * gain) >> 15) };
+        frames[n] = outputFrame(dry, controls, volume, dither);
+        gain += gainStep;
     }
 #ifdef MEASURE_TASK_TIMES
     uint32_t endISR = DWT->CYCCNT;
@@ -904,21 +3141,44 @@ void sampleISR() {
         maxSampleISRTime = elapsed;
     }
 #endif
-    
+
+    // Stop the timer after a stretch of silence, longer with the effects on
+    // so their tails ring out; audioWake() restarts it
+    if (activeNoteCount == 0 && currentNote == NO_NOTE) {
+        uint32_t idle = audioIdleSamples + (controls.effects != FX_OFF ? fxTailSamples : 0);
+        silentSamples += count;
+        if (silentSamples >= idle) stopSampleTimer();
+    }
+    else {
+        silentSamples = 0;
+    }
 }
 
 
 
 
 void CAN_RX_ISR (void) {
-	uint8_t RX_Message_ISR[8];
-	uint32_t ID;
-	CAN_RX(ID, RX_Message_ISR);
-	xQueueSendFromISR(msgInQ, RX_Message_ISR, NULL); // Send the received message to the queue
+	CANFrame frame;
+	CAN_RX(frame.id, frame.data);
+	frame.rxTime = micros();  // Local time; sync frames need the raw clock
+#ifdef MEASURE_LATENCY
+	uint32_t transit = stampAge(frame.data, clockSync.toSynced(frame.rxTime));
+	uint32_t queued = frame.data[FRAME_QUEUE_DELAY] * 32;
+	LATENCY_RECORD(LAT_BUS, transit > queued ? transit - queued : 0);
+#endif
+	xQueueSendFromISR(msgInQ, &frame, NULL); // Send the received message to the queue
 }
 
 void CAN_TX_ISR (void) {
-	xSemaphoreGiveFromISR(CAN_TX_Semaphore, NULL);
+	BaseType_t woken = pdFALSE;
+	uint32_t mailbox = syncTxMailbox;
+	if (mailbox != 0 && CAN_TxCompleteMailbox() == mailbox) {
+		syncTxTime = micros();
+		syncTxMailbox = 0;
+		if (timeSyncHandle != NULL) vTaskNotifyGiveFromISR(timeSyncHandle, &woken);
+	}
+	xSemaphoreGiveFromISR(CAN_TX_Semaphore, &woken);
+	portYIELD_FROM_ISR(woken);
 }
 
 
@@ -929,16 +3189,21 @@ extern volatile uint32_t maxDisplayUpdateTime;
 extern volatile uint32_t maxDecodeTime;
 extern volatile uint32_t maxCAN_TX_Time;
 extern volatile uint32_t maxSampleISRTime;
+extern volatile uint32_t maxEffectsTime;
 #endif
 
 
 
+void reportStackUsage();  // With the task table in RTOS OBJECTS
+void reportSchedulability();
+
 void debugMonitorTask(void * pvParameters) {
     const TickType_t xFrequency = 1000 / portTICK_PERIOD_MS; // once per second
     TickType_t xLastWakeTime = xTaskGetTickCount();
 
     while (1) {
         vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        xSemaphoreTake(serialMutex, portMAX_DELAY);
 
 #ifdef MEASURE_TASK_TIMES
         Serial.println("----- Task Timing (us) -----");
@@ -947,8 +3212,120 @@ void debugMonitorTask(void * pvParameters) {
         Serial.print("maxDecodeTime: "); Serial.println(maxDecodeTime);
         Serial.print("maxCAN_TX_Time: "); Serial.println(maxCAN_TX_Time);
         Serial.print("maxSampleISRTime: "); Serial.println(maxSampleISRTime);
+        Serial.print("maxRoleSwitchTime: "); Serial.println(maxRoleSwitchTime);
+        Serial.print("displayTransfer (last/max us, bytes, queue us, errors): ");
+        Serial.print(lastDisplayTransferTime); Serial.print(" / ");
+        Serial.print(maxDisplayTransferTime); Serial.print(", ");
+        Serial.print(lastDisplayTransferBytes); Serial.print(", ");
+        Serial.print(lastDisplayQueueTime); Serial.print(", ");
+        Serial.println(DisplayDMA_GetErrorCount());
+        Serial.print("logDropped: "); Serial.println(logDropped);
+        Serial.print("limiter min gain (%): "); Serial.println(minLimiterGain * 100 / MOD_ONE);
+        Serial.print("audio wake (last/max us, count), paused ms: ");
+        Serial.print(lastAudioWakeLatency); Serial.print(" / ");
+        Serial.print(maxAudioWakeLatency); Serial.print(", ");
+        Serial.print(audioWakeCount); Serial.print(", ");
+        Serial.println(audioPausedMs());
+        reportStackUsage();
+        reportSchedulability();
         Serial.println("----------------------------\n");
 #endif
+
+#ifdef MEASURE_LATENCY
+        Serial.println("----- Key-to-sound latency (us) -----");
+        for (uint8_t s = 0; s < LAT_STAGE_COUNT; s++) {
+            Serial.print(latencyStageNames[s]);
+            Serial.print(": n="); Serial.print(latencyHist[s].count);
+            Serial.print(" max="); Serial.print(latencyHist[s].maxUs);
+            Serial.print(" |");
+            // Non-empty buckets, labelled by their upper bound
+            for (uint8_t b = 0; b < LATENCY_BUCKETS; b++) {
+                if (latencyHist[s].buckets[b] == 0) continue;
+                Serial.print(" <"); Serial.print(1UL << b);
+                Serial.print(":"); Serial.print(latencyHist[s].buckets[b]);
+            }
+            Serial.println();
+        }
+        Serial.print("clock: ");
+        if (controlState.read().role == RECEIVER) Serial.print("master");
+        else Serial.print(clockSync.isLocked() ? "locked" : "unlocked");
+        Serial.print(" drift(ppm)="); Serial.println(clockSync.getDriftPpm());
+        Serial.println("-------------------------------------\n");
+#endif
+        xSemaphoreGive(serialMutex);
+    }
+}
+
+// Format one log record; returns the line length
+int formatLogEntry(const LogEntry &entry, char* line, size_t size) {
+    const int16_t* a = entry.args;
+    switch (entry.event) {
+    case LOG_TRANSPOSE:
+        return snprintf(line, size, "Transposing %s\r\n", a[0] > 0 ? "Up" : "Down");
+    case LOG_VIEW:
+        return snprintf(line, size, "Display view: %s\r\n",
+                        a[0] == VIEW_SCOPE ? "scope" : a[0] == VIEW_SPECTRUM ? "spectrum" : "status");
+    case LOG_VOICE_MODE:
+        return snprintf(line, size, "Voices: %s\r\n", a[0] == VOICES_DISTRIBUTED ? "distributed" : "central");
+    case LOG_EFFECTS:
+        return snprintf(line, size, "Effects: %s\r\n", effectsName((EffectsPreset)a[0]));
+    case LOG_WAVEFORM:
+        return snprintf(line, size, "Waveform changed to: %s\r\n", waveformName((WaveformType)a[0]));
+    case LOG_ROLE:
+        return snprintf(line, size, "Role changed: %s\r\n", a[0] == RECEIVER ? "receiver" : "sender");
+    case LOG_HANDSHAKE_DONE:
+        return snprintf(line, size, "Handshake: position %d of %d, octave %d\r\n", a[0], a[1], a[2]);
+    case LOG_HANDSHAKE_TIMEOUT:
+        return snprintf(line, size, "Handshake timed out, keeping manual settings\r\n");
+    default:
+        return snprintf(line, size, "log: unknown event %d\r\n", entry.event);
+    }
+}
+
+// Drains the log ring to Serial at the lowest priority. Only as much as the
+// TX buffer has room for is written, so Serial.write never blocks and the
+// interrupt-driven UART does the rest. Sleeps until logEvent() posts a record,
+// polling only while a backlog waits for the UART.
+void loggerTask(void * pvParameters) {
+    const TickType_t xFrequency = 10 / portTICK_PERIOD_MS;
+    char line[64];
+    int lineLength = 0;
+    int lineSent = 0;
+    uint32_t reportedDropped = 0;
+    bool backlog = false;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, backlog ? xFrequency : portMAX_DELAY);
+        backlog = false;
+
+        while (1) {
+            if (lineSent == lineLength) {
+                uint32_t dropped = logDropped;
+                if (dropped != reportedDropped) {
+                    lineLength = snprintf(line, sizeof(line), "log: %lu dropped\r\n",
+                                          (unsigned long)(dropped - reportedDropped));
+                    reportedDropped = dropped;
+                } else if (logTail != logHead) {
+                    lineLength = formatLogEntry(logRing[logTail & (LOG_RING_SIZE - 1)], line, sizeof(line));
+                    logTail = logTail + 1;
+                } else {
+                    break;
+                }
+                if (lineLength >= (int)sizeof(line)) lineLength = sizeof(line) - 1;
+                lineSent = 0;
+            }
+            xSemaphoreTake(serialMutex, portMAX_DELAY);
+            int room = Serial.availableForWrite();
+            int chunk = lineLength - lineSent;
+            if (chunk > room) chunk = room;
+            if (chunk > 0) Serial.write((const uint8_t*)line + lineSent, chunk);
+            xSemaphoreGive(serialMutex);
+            if (room <= 0) {
+                backlog = true;
+                break;
+            }
+            lineSent += chunk;
+        }
     }
 }
 
@@ -962,10 +3339,197 @@ void enableCycleCounter() {
 #endif
 
 
+// ------------------------- RTOS OBJECTS ------------------------------------ //
+
+// Every task, queue and semaphore is allocated statically here, so RAM use is
+// fixed at link time and nothing comes from the FreeRTOS heap. Stack depths
+// are in words; the debug monitor reports each task's high-water mark so they
+// can be checked against real use (MEASURE_TASK_TIMES).
+#if configSUPPORT_STATIC_ALLOCATION != 1
+#error "Build with -D configSUPPORT_STATIC_ALLOCATION=1 (see platformio.ini)"
+#endif
+
+#define STACK_WORDS(stack) (sizeof(stack) / sizeof(StackType_t))
+
+StackType_t scanKeysStack[256];  // Handshake CAN sends, logging and MIDI mirroring
+StackType_t displayUpdateStack[256];
+StackType_t decodeStack[128];
+StackType_t roleManagerStack[128];
+StackType_t timeSyncStack[128];
+StackType_t debugMonitorStack[256];
+StackType_t analysisStack[128];
+StackType_t loggerStack[192];
+StackType_t hostLinkStack[192];
+StackType_t effectsStack[128];
+
+struct StaticTaskSlot {
+    TaskFunction_t function;
+    const char* name;
+    StackType_t* stack;
+    uint32_t stackDepth;      // Words
+    UBaseType_t priority;
+    TaskHandle_t* globalHandle;  // Also published here if not NULL
+    TaskHandle_t handle;
+    StaticTask_t tcb;
+};
+
+StaticTaskSlot taskTable[] = {
+    { scanKeysTask,      "scanKeys",      scanKeysStack,      STACK_WORDS(scanKeysStack),      2, NULL,                 NULL, {} },
+    { displayUpdateTask, "displayUpdate", displayUpdateStack, STACK_WORDS(displayUpdateStack), 1, &displayUpdateHandle, NULL, {} },
+    { decodeTask,        "decodeTask",    decodeStack,        STACK_WORDS(decodeStack),        1, NULL,                 NULL, {} },
+    // Creates CAN_TX_Task and sets the note filter for the starting role
+    { roleManagerTask,   "roleManager",   roleManagerStack,   STACK_WORDS(roleManagerStack),   2, &roleManagerHandle,   NULL, {} },
+    { timeSyncTask,      "timeSync",      timeSyncStack,      STACK_WORDS(timeSyncStack),      1, &timeSyncHandle,      NULL, {} },
+    { debugMonitorTask,  "debugMonitor",  debugMonitorStack,  STACK_WORDS(debugMonitorStack),  1, NULL,                 NULL, {} },
+    { analysisTask,      "analysis",      analysisStack,      STACK_WORDS(analysisStack),      0, NULL,                 NULL, {} },
+    { loggerTask,        "logger",        loggerStack,        STACK_WORDS(loggerStack),        0, &loggerHandle,        NULL, {} },
+    { hostLinkTask,      "hostLink",      hostLinkStack,      STACK_WORDS(hostLinkStack),      1, &hostLinkHandle,      NULL, {} },
+    // Must finish each block within one block period, so above everything
+    { effectsTask,       "effects",       effectsStack,       STACK_WORDS(effectsStack),       3, &effectsHandle,       NULL, {} },
+};
+const uint8_t TASK_COUNT = sizeof(taskTable) / sizeof(taskTable[0]);
+
+// Queues and semaphores
+const UBaseType_t MSG_IN_Q_LENGTH = 36;
+const UBaseType_t HANDSHAKE_Q_LENGTH = 8;
+#ifdef TEST_SCANKEYS
+const UBaseType_t MSG_OUT_Q_LENGTH = 384;  // Larger queue for test iterations.
+#else
+const UBaseType_t MSG_OUT_Q_LENGTH = 36;
+#endif
+
+uint8_t msgInQStorage[MSG_IN_Q_LENGTH * sizeof(CANFrame)];
+uint8_t handshakeQStorage[HANDSHAKE_Q_LENGTH * 8];
+uint8_t msgOutQStorage[MSG_OUT_Q_LENGTH * 8];
+StaticQueue_t msgInQBuffer;
+StaticQueue_t handshakeQBuffer;
+StaticQueue_t msgOutQBuffer;
+StaticSemaphore_t CAN_TX_SemaphoreBuffer;
+StaticSemaphore_t txStoppedSemaphoreBuffer;
+StaticSemaphore_t serialMutexBuffer;
+
+void createQueues() {
+    msgInQ = xQueueCreateStatic(MSG_IN_Q_LENGTH, sizeof(CANFrame), msgInQStorage, &msgInQBuffer);
+    handshakeQ = xQueueCreateStatic(HANDSHAKE_Q_LENGTH, 8, handshakeQStorage, &handshakeQBuffer);
+    msgOutQ = xQueueCreateStatic(MSG_OUT_Q_LENGTH, 8, msgOutQStorage, &msgOutQBuffer);
+    CAN_TX_Semaphore = xSemaphoreCreateCountingStatic(3, 3, &CAN_TX_SemaphoreBuffer);
+    txStoppedSemaphore = xSemaphoreCreateBinaryStatic(&txStoppedSemaphoreBuffer);
+    serialMutex = xSemaphoreCreateMutexStatic(&serialMutexBuffer);
+}
+
+void createTasks() {
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        StaticTaskSlot &slot = taskTable[i];
+        slot.handle = xTaskCreateStatic(slot.function, slot.name, slot.stackDepth, NULL,
+                                        slot.priority, slot.stack, &slot.tcb);
+        if (slot.globalHandle != NULL) *slot.globalHandle = slot.handle;
+    }
+}
+
+// Total statically allocated RTOS memory, printed once at boot
+void printRtosMemory() {
+    uint32_t stackBytes = sizeof(CAN_TX_Stack);
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        stackBytes += taskTable[i].stackDepth * sizeof(StackType_t);
+    }
+    uint32_t queueBytes = sizeof(msgInQStorage) + sizeof(handshakeQStorage) + sizeof(msgOutQStorage);
+    Serial.print("Static RTOS RAM: stacks ");
+    Serial.print(stackBytes);
+    Serial.print(" B, queues ");
+    Serial.print(queueBytes);
+    Serial.println(" B");
+}
+
+void printStackWatermark(const char* name, TaskHandle_t handle, uint32_t depth) {
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(depth - uxTaskGetStackHighWaterMark(handle));
+    Serial.print(" / ");
+    Serial.print(depth);
+    Serial.println(" words");
+}
+
+// Peak stack use of every task, in words
+void reportStackUsage() {
+    Serial.println("----- Stack use (peak / size) -----");
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        printStackWatermark(taskTable[i].name, taskTable[i].handle, taskTable[i].stackDepth);
+    }
+    TaskHandle_t txHandle = CAN_TX_Handle;
+    if (txHandle != NULL) {
+        printStackWatermark("CAN_TX_Task", txHandle, STACK_WORDS(CAN_TX_Stack));
+    }
+}
+
+#ifdef MEASURE_TASK_TIMES
+// Response-time analysis of the measured tasks, rerun on every report so a
+// change that breaks the schedule (more voices, a higher display frame rate)
+// shows up straight away. WCETs are the worst seen since boot. Tasks fed by a
+// queue may lag by a full queue of frames, which sets their deadline. The
+// lines are CSV, so a captured log can be rechecked with tools/rms_analysis.
+void reportSchedulability() {
+    static bool wasSchedulable = true;
+    static char line[80];
+    SchedTask tasks[] = {
+        { "audioBlockISR",     255, CONTROL_BLOCK * 1000000 / sampleRate, maxSampleISRTime, 0,                           0, false },
+        { "effectsTask",       3,   CONTROL_BLOCK * 1000000 / sampleRate, maxEffectsTime, 0,                           0, false },
+        { "scanKeysTask",      2,   SCAN_PERIOD_MS * 1000,       maxScanKeysTime,      0,                                  0, false },
+        { "displayUpdateTask", 1,   DISPLAY_MIN_FRAME_MS * 1000, maxDisplayUpdateTime, 0,                                  0, false },
+        { "decodeTask",        1,   CAN_FRAME_US,                maxDecodeTime,        MSG_IN_Q_LENGTH * CAN_FRAME_US,     0, false },
+        { "CAN_TX_Task",       1,   CAN_FRAME_US,                maxCAN_TX_Time,       MSG_OUT_Q_LENGTH * CAN_FRAME_US,    0, false },
+    };
+    const uint8_t count = sizeof(tasks) / sizeof(tasks[0]);
+    SchedResult result = Sched_Analyse(tasks, count);
+
+    Serial.println("----- Schedulability (RMS) -----");
+    Sched_FormatHeader(line, sizeof(line));
+    Serial.println(line);
+    for (uint8_t i = 0; i < count; i++) {
+        Sched_FormatTask(tasks[i], line, sizeof(line));
+        Serial.println(line);
+    }
+    Sched_FormatResult(result, line, sizeof(line));
+    Serial.println(line);
+
+    if (wasSchedulable && !result.schedulable) {
+        Serial.println("WARNING: task set is no longer schedulable");
+    }
+    wasSchedulable = result.schedulable;
+}
+#endif
+
+// Memory for the idle and timer service tasks, required with static allocation
+StaticTask_t idleTaskTCB;
+StackType_t idleTaskStack[configMINIMAL_STACK_SIZE];
+
+extern "C" void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                              StackType_t **ppxIdleTaskStackBuffer,
+                                              uint32_t *pulIdleTaskStackSize) {
+    *ppxIdleTaskTCBBuffer = &idleTaskTCB;
+    *ppxIdleTaskStackBuffer = idleTaskStack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+#if configUSE_TIMERS == 1
+StaticTask_t timerTaskTCB;
+StackType_t timerTaskStack[configTIMER_TASK_STACK_DEPTH];
+
+extern "C" void vApplicationGetTimerTaskMemory(StaticTask_t **ppxTimerTaskTCBBuffer,
+                                               StackType_t **ppxTimerTaskStackBuffer,
+                                               uint32_t *pulTimerTaskStackSize) {
+    *ppxTimerTaskTCBBuffer = &timerTaskTCB;
+    *ppxTimerTaskStackBuffer = timerTaskStack;
+    *pulTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
+}
+#endif
+
 // ------------------------- SETUP & LOOP ------------------------------------ //
 
 void setup() {
-    Serial.begin(9600);
+    Serial.begin(HOST_BAUD);
+    HostLink_Init();
+    HostLink_RegisterRxISR(hostRxISR);
+    MidiBridge_RegisterNoteCallback(injectNote);
 #ifdef TEST_SCANKEYS
     delay(3000);
 #endif
@@ -977,8 +3541,6 @@ void setup() {
     pinMode(RA2_PIN, OUTPUT);
     pinMode(REN_PIN, OUTPUT);
     pinMode(OUT_PIN, OUTPUT);
-    pinMode(OUTL_PIN, OUTPUT);
-    pinMode(OUTR_PIN, OUTPUT);
     pinMode(LED_BUILTIN, OUTPUT);
 
     pinMode(C0_PIN, INPUT);
@@ -993,67 +3555,60 @@ void setup() {
     delayMicroseconds(2);
     setOutMuxBit(DRST_BIT, HIGH);  //Release display logic reset
     u8g2.begin();
+    DisplayDMA_RegisterDoneISR(displayDoneISR);
     setOutMuxBit(DEN_BIT, HIGH);  //Enable display power supply
 
     for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
-        activeNotes[i].stepSize = 0;
+        activeNotes[i].step = 0;
         activeNotes[i].phaseAcc = 0;
     }
     activeNoteCount = 0;
+    initAnalysisTables();
+    initEffects();
     
-    
-    // Initialize audio sample timer
-    sampleTimer.setOverflow(SAMPLE_RATE, HERTZ_FORMAT);
+    // Initialize the DAC, its sample clock and the block DMA
+    selectSampleRate();
+    AudioDMA_Init(sampleRate);
 //#ifndef DISABLE_ISRS
-    sampleTimer.attachInterrupt(sampleISR);
+    AudioDMA_RegisterBlockISR(audioBlockISR);
 //#endif
-    sampleTimer.resume();
+    AudioDMA_Start();
     
+#ifdef CAN_LOOPBACK
     CAN_Init(true);
-    setCANFilter(0x123, 0x7ff); 
+#else
+    CAN_Init(false);
+#endif
+    setCANFilter(CAN_ID_SYNC, CAN_CONTROL_MASK, 0);
 //#ifndef DISABLE_ISRS
     CAN_RegisterRX_ISR(CAN_RX_ISR);
     CAN_RegisterTX_ISR(CAN_TX_ISR);
 //#endif
     CAN_Start();
     
-    sysState.mutex = xSemaphoreCreateMutex();
 #ifdef MEASURE_TASK_TIMES
     enableCycleCounter();
 #endif
-    msgInQ = xQueueCreate(36, 8);
-#ifdef TEST_SCANKEYS
-    msgOutQ = xQueueCreate(384, 8);  // Larger queue for test iterations.
-#else
-    msgOutQ = xQueueCreate(36, 8);
-#endif
-    CAN_TX_Semaphore = xSemaphoreCreateCounting(3, 3);
+    createQueues();
+
+    // Start at the middle octave until auto-detection assigns one
+    sysState.knob2.setRotation(moduleOctave);
+    sysState.knob1.setRotation(4);  // Centre: square pulse width
+    handshake.moduleID = getModuleID();
+    startHandshake();
+    publishControls();
 
 
 
 #ifndef DISABLE_THREADS
     Serial.print("modulerole: ");
     Serial.println(moduleRole);
-    TaskHandle_t scanKeysHandle = NULL;
-    xTaskCreate(scanKeysTask, "scanKeys", 64, NULL, 2, &scanKeysHandle);
-    
-    TaskHandle_t displayUpdateHandle = NULL;
-    xTaskCreate(displayUpdateTask, "displayUpdate", 256, NULL, 1, &displayUpdateHandle);
-    
-    // Always create decodeTask so that received messages are processed.
-    TaskHandle_t decodeTaskHandle = NULL;
-    xTaskCreate(decodeTask, "decodeTask", 128, NULL, 1, &decodeTaskHandle);
-
-
-
-    if (moduleRole == SENDER) {
-        TaskHandle_t CAN_TX_Handle = NULL;
-        xTaskCreate(CAN_TX_Task, "CAN_TX_Task", 128, NULL, 1, &CAN_TX_Handle);
-    }
-
-    TaskHandle_t debugHandle = NULL;
-    xTaskCreate(debugMonitorTask, "debugMonitor", 256, NULL, 1, &debugHandle);
+    printRtosMemory();
+    createTasks();
 
+#if configUSE_TICKLESS_IDLE == 1
+    halTickOffset = uwTick;  // millis() carries on from here on the RTOS tick
+#endif
     // Start the scheduler
     vTaskStartScheduler();
 
@@ -1084,23 +3639,24 @@ void setup() {
 #ifdef TEST_DECODE
 {
     // Preload msgInQ with 32 test messages.
-    uint8_t testMsg[8] = { 'P', 4, 0, 0, 0, 0, 0, 0 };  // A sample press message.
+    CANFrame testMsg = { CAN_ID_NOTE, 0, { 'P', 4, 0, 0, 0, 0, 0, 0 } };  // A sample press message.
     for (int i = 0; i < 32; i++) {
-        xQueueSend(msgInQ, testMsg, portMAX_DELAY);
+        xQueueSend(msgInQ, &testMsg, portMAX_DELAY);
     }
   
     uint32_t startTime_decode = micros();
     for (int iter = 0; iter < 32; iter++) {
-        uint8_t localMsg[8];
+        CANFrame frame;
+        uint8_t *localMsg = frame.data;
         // Wait (blocking) for a test message.
-        if (xQueueReceive(msgInQ, localMsg, portMAX_DELAY) == pdPASS) {
+        if (xQueueReceive(msgInQ, &frame, portMAX_DELAY) == pdPASS) {
             TASK_START();  // Begin timing this decode iteration
 
             // --- DecodeTask processing logic ---
             if (localMsg[0] == 'R') {  // Release message: remove note.
-                uint8_t note = localMsg[2];
+                uint8_t note = midiNote(localMsg[1], localMsg[2]);
                 for (uint8_t i = 0; i < activeNoteCount; i++) {
-                    if (activeNotes[i].stepSize == stepSizes[note]) {
+                    if (activeNotes[i].note == note) {
                         // Remove note by shifting remaining notes.
                         for (uint8_t j = i; j < activeNoteCount - 1; j++) {
                             activeNotes[j] = activeNotes[j + 1];
@@ -1110,20 +3666,25 @@ void setup() {
                     }
                 }
             } else if (localMsg[0] == 'P') {  // Press message: add note.
-                uint8_t octave = localMsg[1];
-                uint8_t note = localMsg[2];
-                if (note < 12 && activeNoteCount < MAX_POLYPHONY) {
-                    uint32_t step = stepSizes[note];
-                    activeNotes[activeNoteCount].stepSize = step;
+                uint8_t key = localMsg[2];
+                if (key < 12 && activeNoteCount < MAX_POLYPHONY) {
+                    uint8_t note = midiNote(localMsg[1], key);
+                    activeNotes[activeNoteCount].step = noteStep(note);
                     activeNotes[activeNoteCount].phaseAcc = 0;
                     activeNotes[activeNoteCount].elapsed = 0;
+                    activeNotes[activeNoteCount].note = note;
+                    activeNotes[activeNoteCount].velocity = MIDI_KEY_VELOCITY;
+                    activeNotes[activeNoteCount].pressure = 0;
+                    activeNotes[activeNoteCount].pan = panPosition(note, localMsg[1]);
+                    activeNotes[activeNoteCount].mod.ready = false;
+                    SVF_Reset(activeNotes[activeNoteCount].filter);
                     activeNoteCount++;
                 }
             }
-            // Update RX_Message for debug (protected by mutex)
-            xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-            memcpy(sysState.RX_Message, localMsg, sizeof(sysState.RX_Message));
-            xSemaphoreGive(sysState.mutex);
+            // Publish for the display
+            RXMessage rx;
+            memcpy(rx.data, localMsg, sizeof(rx.data));
+            lastRXMessage.write(rx);
             // --- End decodeTask processing ---
 
             TASK_END(maxDecodeTime);  // End timing and update maxDecodeTime
@@ -1191,63 +3752,7 @@ void setup() {
 
 #ifdef TEST_DISPLAYUPDATE
 {
-    // Execute one iteration of displayUpdateTask (simulate the task code without the loop)
-    TASK_START();
-    digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
-
-    // Update joystick values
-    int rawJoyX = analogRead(JOYX_PIN);
-    int rawJoyY = analogRead(JOYY_PIN);
-    joyX12Val = map(rawJoyX, 800, 119, 0, 12);
-    joyY12Val = map(rawJoyY, 800, 119, 0, 12);
-
-    // Read knob value under mutex
-    xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-    int rotationCopy = sysState.knob3.getRotation();
-    xSemaphoreGive(sysState.mutex);
-
-    // Prepare the display buffer
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB08_tr);
-    u8g2.drawStr(2, 10, moduleRole == SENDER ? "SENDER" : "RECEIVER");
-    u8g2.setCursor(75, 10);
-    u8g2.print("(");
-    u8g2.print(joyX12Val);
-    u8g2.print(",");
-    u8g2.print(joyY12Val);
-    u8g2.print(")");
-
-    // Display current waveform
-    u8g2.setCursor(2, 20);
-    if (currentWaveform == SAWTOOTH) u8g2.print("Sawtooth");
-    else if (currentWaveform == TRIANGLE) u8g2.print("Triangle");
-    else if (currentWaveform == SINE) u8g2.print("Sine");
-    else if (currentWaveform == SQUARE) u8g2.print("Square");
-    else if (currentWaveform == PULSE) u8g2.print("Pulse");
-    else if (currentWaveform == NOISE) u8g2.print("Noise");
-    else if (currentWaveform == PIANO) u8g2.print("Piano");
-
-    // Display volume and pitch
-    u8g2.setCursor(2, 30);
-    u8g2.print("Volume: ");
-    u8g2.print(rotationCopy);
-    u8g2.setCursor(66, 20);
-    u8g2.print("Pitch: ");
-    u8g2.print(moduleOctave);
-
-    // Display last received CAN message
-    xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-    u8g2.setCursor(66, 30);
-    u8g2.print(sysState.RX_Message[0] == 'P' ? "P" : "R");
-    u8g2.print(sysState.RX_Message[1]);
-    u8g2.print(sysState.RX_Message[2]);
-    xSemaphoreGive(sysState.mutex);
-
-    u8g2.sendBuffer();
-    digitalToggle(LED_BUILTIN);
-    TASK_END(maxDisplayUpdateTime);
-
-    // Now perform 32 iterations of the same display update code:
+    // Worst case: every field redrawn and the whole frame sent, 32 times
     uint32_t startTime_display = micros();
     for (int iter = 0; iter < 32; iter++) {
          TASK_START();
@@ -1258,44 +3763,8 @@ void setup() {
          joyX12Val = map(rawJoyX, 800, 119, 0, 12);
          joyY12Val = map(rawJoyY, 800, 119, 0, 12);
 
-         xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-         int rotationCopy = sysState.knob3.getRotation();
-         xSemaphoreGive(sysState.mutex);
-
-         u8g2.clearBuffer();
-         u8g2.setFont(u8g2_font_ncenB08_tr);
-         u8g2.drawStr(2, 10, moduleRole == SENDER ? "SENDER" : "RECEIVER");
-         u8g2.setCursor(75, 10);
-         u8g2.print("(");
-         u8g2.print(joyX12Val);
-         u8g2.print(",");
-         u8g2.print(joyY12Val);
-         u8g2.print(")");
-
-         u8g2.setCursor(2, 20);
-         if (currentWaveform == SAWTOOTH) u8g2.print("Sawtooth");
-         else if (currentWaveform == TRIANGLE) u8g2.print("Triangle");
-         else if (currentWaveform == SINE) u8g2.print("Sine");
-         else if (currentWaveform == SQUARE) u8g2.print("Square");
-         else if (currentWaveform == PULSE) u8g2.print("Pulse");
-         else if (currentWaveform == NOISE) u8g2.print("Noise");
-         else if (currentWaveform == PIANO) u8g2.print("Piano");
-
-         u8g2.setCursor(2, 30);
-         u8g2.print("Volume: ");
-         u8g2.print(rotationCopy);
-         u8g2.setCursor(66, 20);
-         u8g2.print("Pitch: ");
-         u8g2.print(moduleOctave);
-
-         xSemaphoreTake(sysState.mutex, portMAX_DELAY);
-         u8g2.setCursor(66, 30);
-         u8g2.print(sysState.RX_Message[0] == 'P' ? "P" : "R");
-         u8g2.print(sysState.RX_Message[1]);
-         u8g2.print(sysState.RX_Message[2]);
-         xSemaphoreGive(sysState.mutex);
-
-         u8g2.sendBuffer();
+         renderDisplayFrame(UI_EVT_REDRAW);
+
          digitalToggle(LED_BUILTIN);
          TASK_END(maxDisplayUpdateTime);
     }
@@ -1307,10 +3776,206 @@ void setup() {
     Serial.print("Average time per iteration: ");
     Serial.print(avgTime_display);
     Serial.println(" microseconds");
-    float cpuLoad_display = (avgTime_display / 100000.0f) * 100.0f; // Assuming period of 100ms
+    float cpuLoad_display = (avgTime_display / (DISPLAY_MIN_FRAME_MS * 1000.0f)) * 100.0f; // At the max frame rate
     Serial.print("displayUpdateTask CPU Load: ");
     Serial.print(cpuLoad_display, 2);
-    Serial.println(" %");
+    Serial.println(" % (includes waiting for the previous DMA frame)");
+    DisplayDMA_WaitIdle();
+    Serial.print("Full frame: queued in ");
+    Serial.print(lastDisplayQueueTime);
+    Serial.print(" us, DMA transfer ");
+    Serial.print(lastDisplayTransferTime);
+    Serial.println(" us");
+
+    // Typical case: only the volume field changes between frames
+    uint32_t startTime_incremental = micros();
+    for (int iter = 0; iter < 32; iter++) {
+         sysState.knob3.setRotation(iter % 9);
+         renderDisplayFrame(UI_EVT_VOLUME);
+    }
+    DisplayDMA_WaitIdle();
+    Serial.print("Average incremental frame: ");
+    Serial.print((micros() - startTime_incremental) / 32);
+    Serial.print(" microseconds, I2C transfer ");
+    Serial.print(lastDisplayTransferTime);
+    Serial.print(" us for ");
+    Serial.print(lastDisplayTransferBytes);
+    Serial.print(" bytes, queued in ");
+    Serial.print(lastDisplayQueueTime);
+    Serial.println(" us");
+    while(1);
+}
+#endif
+
+#ifdef TEST_TIMESYNC
+{
+    // Simulate several followers with drifting, offset oscillators on an ideal
+    // loopback bus: each SYNC reaches every node at the same true instant, plus
+    // up to 15 us of RX interrupt jitter. The master clock is true time.
+    const uint8_t nodes = 4;
+    const double ppm[nodes] = { 120.0, -80.0, 35.0, -150.0 };
+    const uint32_t offset[nodes] = { 1000u, 123456789u, 4000000000u, 77u };
+    ClockSync followers[nodes];
+    uint32_t noiseSeed = 0x12345678;
+    int32_t worstSpread = 0;
+
+    for (uint32_t sync = 0; sync < 600; sync++) {
+        double t = (double)sync * SYNC_PERIOD_MS * 1000.0;
+        for (uint8_t n = 0; n < nodes; n++) {
+            noiseSeed = noiseSeed * 1664525UL + 1013904223UL;
+            uint32_t local = offset[n] + (uint32_t)(uint64_t)(t * (1.0 + ppm[n] * 1e-6)) + (noiseSeed >> 28);
+            followers[n].onSync(local, (uint32_t)(uint64_t)t);
+        }
+        // After a short warm-up, compare every node halfway between syncs,
+        // where uncorrected drift would be largest.
+        if (sync < 10) continue;
+        double probe = t + SYNC_PERIOD_MS * 500.0;
+        int32_t minErr = 0, maxErr = 0;  // The master itself has zero error
+        for (uint8_t n = 0; n < nodes; n++) {
+            uint32_t local = offset[n] + (uint32_t)(uint64_t)(probe * (1.0 + ppm[n] * 1e-6));
+            int32_t err = (int32_t)(followers[n].toSynced(local) - (uint32_t)(uint64_t)probe);
+            if (err < minErr) minErr = err;
+            if (err > maxErr) maxErr = err;
+        }
+        if (maxErr - minErr > worstSpread) worstSpread = maxErr - minErr;
+    }
+
+    Serial.print("Time sync: worst disagreement across ");
+    Serial.print(nodes + 1);
+    Serial.print(" nodes: ");
+    Serial.print(worstSpread);
+    Serial.println(worstSpread < 100 ? " us (PASS, < 100 us)" : " us (FAIL, >= 100 us)");
+    for (uint8_t n = 0; n < nodes; n++) {
+        Serial.print("  node "); Serial.print(n + 1);
+        Serial.print(" drift estimate (ppm): "); Serial.println(followers[n].getDriftPpm());
+    }
+
+    while(1);
+}
+#endif
+
+
+#ifdef TEST_POLYPHONY
+{
+    // Time the audio render with 0..MAX_POLYPHONY voices at every supported
+    // rate and report the most voices that leave a quarter of each sample
+    // period free for the tasks.
+    const uint16_t SAMPLES = 256;
+    uint32_t frames[AUDIO_BLOCK_FRAMES];
+    const WaveformType modes[] = { SAWTOOTH, SINE, PIANO };
+    const uint8_t MODE_COUNT = sizeof(modes) / sizeof(modes[0]);
+
+    AudioDMA_Stop();
+    moduleRole = RECEIVER;
+    voiceMode = VOICES_CENTRAL;
+
+    for (uint8_t rate = 0; rate < SAMPLE_RATE_COUNT; rate++) {
+        applySampleRate(rate);
+        uint32_t budgetNs = 750000000UL / sampleRate;
+        Serial.print(sampleRate);
+        Serial.print(" Hz (budget ");
+        Serial.print(budgetNs);
+        Serial.print(" ns):");
+
+        for (uint8_t m = 0; m < MODE_COUNT; m++) {
+            currentWaveform = modes[m];
+            publishControls();
+            uint8_t maxVoices = 0;
+            uint32_t costAtMax = 0;
+            for (uint8_t voices = 0; voices <= MAX_POLYPHONY; voices++) {
+                for (uint8_t i = 0; i < voices; i++) {
+                    activeNotes[i].note = midiNote(4, i % 12);
+                    activeNotes[i].step = noteStep(activeNotes[i].note);
+                    activeNotes[i].phaseAcc = 0;
+                    activeNotes[i].elapsed = 0;
+                    activeNotes[i].velocity = MIDI_KEY_VELOCITY;
+                    activeNotes[i].pressure = 0;
+                    activeNotes[i].pan = panPosition(activeNotes[i].note, 4);
+                    activeNotes[i].mod.ready = false;
+                    SVF_Reset(activeNotes[i].filter);
+                }
+                activeNoteCount = voices;
+                silentSamples = 0;
+
+                uint32_t start = micros();
+                for (uint16_t s = 0; s < SAMPLES; s += AUDIO_BLOCK_FRAMES) {
+                    audioBlockISR(frames, AUDIO_BLOCK_FRAMES);
+                }
+                uint32_t costNs = (micros() - start) * 1000 / SAMPLES;
+                if (costNs > budgetNs) break;
+                maxVoices = voices;
+                costAtMax = costNs;
+            }
+            Serial.print(" ");
+            Serial.print(waveformName(modes[m]));
+            Serial.print(" ");
+            Serial.print(maxVoices);
+            if (maxVoices == MAX_POLYPHONY) Serial.print("+");
+            Serial.print(" (");
+            Serial.print(costAtMax);
+            Serial.print(" ns)");
+        }
+        Serial.println();
+    }
+    activeNoteCount = 0;
+
+    while(1);
+}
+#endif
+
+#ifdef TEST_MIDI
+{
+    // Replay a simulated USB-MIDI event stream through the bridge and check
+    // the note frames that reach decodeTask's queue. tools/midi_bridge_test.cpp
+    // checks the bridge itself on the host; this covers injectNote().
+    const uint8_t stream[][4] = {
+        { 0x09, 0x90, 60, 100 },  // C4 on
+        { 0x09, 0x90, 64, 90 },   // E4 on
+        { 0x0B, 0xB0, 7, 127 },   // Volume CC, ignored
+        { 0x08, 0x80, 60, 0 },    // C4 off
+        { 0x09, 0x90, 64, 0 },    // E4 off as note on with velocity 0
+        { 0x09, 0x90, 5, 100 },   // Below octave 0, dropped
+        { 0x09, 0x90, 127, 100 }, // Above octave 8, dropped
+    };
+    const uint8_t expected[][3] = {
+        { 'P', 4, 0 }, { 'P', 4, 4 }, { 'R', 4, 0 }, { 'R', 4, 4 },
+    };
+    const uint8_t STREAM_LEN = sizeof(stream) / sizeof(stream[0]);
+    const uint8_t EXPECTED_LEN = sizeof(expected) / sizeof(expected[0]);
+
+    moduleRole = RECEIVER;
+    voiceMode = VOICES_CENTRAL;
+    publishControls();
+    xQueueReset(msgInQ);
+
+    uint32_t start = micros();
+    for (uint8_t i = 0; i < STREAM_LEN; i++) MidiBridge_Receive(stream[i]);
+    uint32_t elapsed = micros() - start;
+
+    bool pass = (uxQueueMessagesWaiting(msgInQ) == EXPECTED_LEN);
+    CANFrame frame;
+    for (uint8_t i = 0; i < EXPECTED_LEN && pass; i++) {
+        xQueueReceive(msgInQ, &frame, 0);
+        pass = frame.id == CAN_ID_NOTE && frame.data[0] == expected[i][0] &&
+               frame.data[1] == expected[i][1] && frame.data[2] == expected[i][2];
+    }
+
+    // Local keys go out as note on/off packets
+    MidiBridge_MirrorKey(true, midiNote(4, 9));
+    MidiBridge_MirrorKey(false, midiNote(4, 9));
+    MidiPacket out;
+    pass = pass && MidiBridge_TakePacket(out) && out.data[0] == 0x09 && out.data[1] == 0x90 &&
+           out.data[2] == 69 && out.data[3] == MIDI_KEY_VELOCITY;
+    pass = pass && MidiBridge_TakePacket(out) && out.data[0] == 0x08 && out.data[1] == 0x80 &&
+           out.data[2] == 69 && out.data[3] == 0;
+    pass = pass && !MidiBridge_TakePacket(out);
+
+    Serial.print("MIDI bridge: ");
+    Serial.print(pass ? "PASS" : "FAIL");
+    Serial.print(", ");
+    Serial.print(elapsed / STREAM_LEN);
+    Serial.println(" us per packet");
+
     while(1);
 }
 #endif
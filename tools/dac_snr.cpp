@@ -0,0 +1,111 @@
+// Host-side SNR measurement of the audio output stage.
+//
+// Runs a sine through the firmware's output quantiser from lib/Dither and
+// through a model of the old 8-bit path (Q15 mix >> 8, scaled by the volume
+// knob in integer steps, offset to 0-255). For each note level and volume it
+// prints the signal-to-noise ratio over the whole band and below an eighth of
+// the sample rate, where the noise shaper leaves less noise, and the largest
+// single spur, which is where undithered rounding shows up as distortion.
+// Signal is the output's power at the tone, noise is every other bin except
+// DC, so distortion counts as noise. The tone sits exactly on a DFT bin so no
+// window is needed. A path that rounds the tone away entirely shows "silent".
+//
+// Build and run from the repository root:
+//   g++ -O2 -Ilib/Dither tools/dac_snr.cpp lib/Dither/Dither.cpp -o dac_snr
+//   ./dac_snr [sample_rate]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Dither.h"
+
+const uint32_t N = 4096;               // Analysis length, a power of two
+const uint32_t TONE_BIN = 185;         // About 1 kHz at 22050 Hz; odd, so no sample phase repeats
+
+enum Path { PATH_8BIT, PATH_12BIT_OFF, PATH_12BIT_TPDF, PATH_12BIT_SHAPED, PATH_COUNT };
+const char* pathNames[PATH_COUNT] = { "8-bit", "12-bit", "12 TPDF", "12 shaped" };
+
+struct Result {
+    double snr;                        // dB, full band
+    double snrLow;                     // dB, below fs / 8
+    double spur;                       // dBc, largest bin other than the tone
+};
+
+static double cosTable[N];
+
+// Output of one path in Q15 units
+static void render(Path path, double level, int volume, double* out) {
+    Dither state;
+    Dither_Reset(state, 0x6A09E667);
+    for (uint32_t n = 0; n < N; n++) {
+        // The mix is Q15 before the volume stage in both paths
+        double x = level * 32767.0 * sin(2.0 * M_PI * TONE_BIN * n / N);
+        int32_t mix = (int32_t)lrint(x);
+        if (path == PATH_8BIT) {
+            int32_t code = ((mix >> 8) * volume) / 8 + 128;
+            if (code < 0) code = 0;
+            if (code > 255) code = 255;
+            out[n] = (code - 128) * 256.0;
+        } else {
+            DitherMode mode = (path == PATH_12BIT_OFF) ? DITHER_OFF
+                            : (path == PATH_12BIT_TPDF) ? DITHER_TPDF : DITHER_SHAPED;
+            uint16_t code = Dither_Quantise(state, (mix * volume) >> 3, mode);
+            out[n] = (code - 2048) * 16.0;
+        }
+    }
+}
+
+static Result measure(Path path, double level, int volume) {
+    static double out[N];
+    render(path, level, volume, out);
+
+    // Power of each DFT bin above DC
+    double signal = 0.0, noise = 0.0, noiseLow = 0.0, spur = 0.0;
+    for (uint32_t k = 1; k < N / 2; k++) {
+        double re = 0.0, im = 0.0;
+        for (uint32_t n = 0; n < N; n++) {
+            re += out[n] * cosTable[(k * n) & (N - 1)];
+            im += out[n] * cosTable[(k * n + 3 * N / 4) & (N - 1)];
+        }
+        double power = 2.0 * (re * re + im * im) / ((double)N * N);
+        if (k == TONE_BIN) {
+            signal = power;
+            continue;
+        }
+        noise += power;
+        if (k < N / 8) noiseLow += power;
+        if (power > spur) spur = power;
+    }
+    return { 10.0 * log10(signal / noise), 10.0 * log10(signal / noiseLow), 10.0 * log10(spur / signal) };
+}
+
+int main(int argc, char** argv) {
+    uint32_t rate = (argc > 1) ? atoi(argv[1]) : 22050;
+    if (rate == 0) {
+        fprintf(stderr, "usage: %s [sample_rate]\n", argv[0]);
+        return 2;
+    }
+    for (uint32_t n = 0; n < N; n++) cosTable[n] = cos(2.0 * M_PI * n / N);
+
+    // Full-scale chord, a single note of a chord, a quiet decay
+    const double levels[] = { 0.9, 0.25, 0.02 };
+    const int volumes[] = { 8, 4, 1 };
+    printf("Tone %.0f Hz at %u Hz; SNR full band / below %u Hz, then largest spur\n\n",
+           (double)TONE_BIN * rate / N, rate, rate / 8);
+    printf("%-8s %-6s", "dBFS", "volume");
+    for (int p = 0; p < PATH_COUNT; p++) printf(" %22s", pathNames[p]);
+    printf("\n");
+    for (double level : levels) {
+        for (int volume : volumes) {
+            printf("%-8.1f %-6d", 20.0 * log10(level), volume);
+            for (int p = 0; p < PATH_COUNT; p++) {
+                Result r = measure((Path)p, level, volume);
+                if (!isfinite(r.snr)) printf(" %22s", "silent");
+                else printf("   %5.1f / %5.1f %6.1f", r.snr, r.snrLow, r.spur);
+            }
+            printf("\n");
+        }
+    }
+    printf("\nSNR in dB (higher is better), spur in dBc (lower is better)\n");
+    return 0;
+}
@@ -0,0 +1,365 @@
+// Host-side driver for the binary host link (Linux).
+//
+// Replays a scripted performance into a module over its ST-Link serial port
+// and reports how well the link kept up: send timing, round-trip latency from
+// periodic pings, and the module's own frame and error counts from its
+// telemetry. The frame format is the shared code in lib/HostLink.
+//
+// Script lines are "<time_ms> <command> <args>", with # comments:
+//   0    on 60 100      note on (MIDI note, velocity)
+//   500  off 60         note off
+//   800  knob 3 6       set knob 3 (volume) to 6
+//   850  pan random     stereo placement: key, module or random
+//   860  dither shaped  DAC dither: off, tpdf or shaped
+//   900  ping           extra ping (one is sent every 100 ms anyway)
+//
+// --flood N sends N maximum-size frames back to back instead, to measure
+// throughput. -v copies the module's log text to stderr.
+//
+// Build and run from the repository root:
+//   g++ -O2 -Ilib/HostLink tools/host_link.cpp lib/HostLink/HostProtocol.cpp -o host_link
+//   ./host_link /dev/ttyACM0 performance.txt
+//   ./host_link /dev/ttyACM0 --flood 10000
+
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "HostProtocol.h"
+
+const uint32_t RX_SIZE = 4096;
+const uint32_t RX_MASK = RX_SIZE - 1;
+const uint64_t PING_PERIOD_US = 100000;
+const uint64_t SETTLE_US = 500000;     // Wait for the last replies and telemetry
+
+struct Event {
+    uint64_t timeUs;
+    uint8_t type;
+    uint8_t payload[4];
+    uint8_t length;
+};
+
+struct Link {
+    int fd;
+    bool verbose;
+    uint8_t rx[RX_SIZE];
+    uint32_t rxHead;                   // Bytes received
+    uint32_t rxTail;                   // Bytes parsed
+    uint32_t pingSequence;
+    std::vector<uint64_t> rttUs;
+    uint32_t midiOut;
+    uint32_t telemetryCount;
+    HostTelemetry telemetry;
+    uint64_t txFrames;
+    uint64_t txBytes;
+};
+
+static uint64_t nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool openPort(Link &link, const char* path, speed_t baud) {
+    link.fd = open(path, O_RDWR | O_NOCTTY);
+    if (link.fd < 0) {
+        perror(path);
+        return false;
+    }
+    termios tio;
+    tcgetattr(link.fd, &tio);
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud);
+    cfsetospeed(&tio, baud);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(link.fd, TCSANOW, &tio) != 0) {
+        perror("tcsetattr");
+        return false;
+    }
+    tcflush(link.fd, TCIOFLUSH);
+    return true;
+}
+
+static void sendFrame(Link &link, uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[HOST_MAX_FRAME];
+    uint32_t size = HostProto_Encode(type, payload, length, frame);
+    uint32_t sent = 0;
+    while (sent < size) {
+        ssize_t n = write(link.fd, frame + sent, size - sent);
+        if (n < 0) {
+            perror("write");
+            exit(2);
+        }
+        sent += n;
+    }
+    link.txFrames++;
+    link.txBytes += size;
+}
+
+static void sendPing(Link &link) {
+    // Sequence number and send time come back unchanged in the pong
+    uint8_t payload[12];
+    uint64_t now = nowUs();
+    memcpy(payload, &link.pingSequence, 4);
+    memcpy(payload + 4, &now, 8);
+    link.pingSequence++;
+    sendFrame(link, HOST_PING, payload, sizeof(payload));
+}
+
+static void handleFrame(Link &link, const HostFrame &frame) {
+    switch (frame.type) {
+        case HOST_PONG:
+            if (frame.length == 12) {
+                uint64_t sentAt = 0;
+                for (int i = 0; i < 8; i++) {
+                    sentAt |= (uint64_t)link.rx[(frame.payload + 4 + i) & RX_MASK] << (8 * i);
+                }
+                link.rttUs.push_back(nowUs() - sentAt);
+            }
+            break;
+        case HOST_MIDI_OUT:
+            link.midiOut++;
+            break;
+        case HOST_TELEMETRY:
+            if (frame.length == HOST_TELEMETRY_SIZE) {
+                HostProto_UnpackTelemetry(link.rx, RX_MASK, frame.payload, link.telemetry);
+                link.telemetryCount++;
+            }
+            break;
+    }
+}
+
+// Read whatever has arrived, waiting at most timeoutUs, and handle the frames
+static void receive(Link &link, uint64_t timeoutUs) {
+    pollfd pfd = { link.fd, POLLIN, 0 };
+    if (poll(&pfd, 1, (int)((timeoutUs + 999) / 1000)) <= 0) return;
+
+    uint32_t space = RX_SIZE - (link.rxHead - link.rxTail);
+    uint32_t contiguous = RX_SIZE - (link.rxHead & RX_MASK);
+    ssize_t n = read(link.fd, &link.rx[link.rxHead & RX_MASK], std::min(space, contiguous));
+    if (n <= 0) return;
+    link.rxHead += n;
+
+    while (link.rxHead != link.rxTail) {
+        HostFrame frame;
+        HostParseResult result = HostProto_Parse(link.rx, RX_MASK, link.rxTail,
+                                                 link.rxHead - link.rxTail, frame);
+        if (result == HOST_FRAME_INCOMPLETE) break;
+        if (result == HOST_FRAME_OK) {
+            handleFrame(link, frame);
+            link.rxTail += frame.size;
+        } else {
+            // Anything outside a frame is log text
+            if (link.verbose) fputc(link.rx[link.rxTail & RX_MASK], stderr);
+            link.rxTail++;
+        }
+    }
+}
+
+// Keep receiving until the given time
+static void receiveUntil(Link &link, uint64_t deadline) {
+    for (uint64_t now = nowUs(); now < deadline; now = nowUs()) {
+        receive(link, deadline - now);
+    }
+}
+
+static bool parseScript(const char* path, std::vector<Event> &events) {
+    FILE* input = fopen(path, "r");
+    if (!input) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), input)) {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = 0;
+        double timeMs;
+        char command[16];
+        int a = 0, b = 0;
+        int fields = sscanf(line, "%lf %15s %d %d", &timeMs, command, &a, &b);
+        if (fields <= 0) continue;
+
+        Event event = {};
+        event.timeUs = (uint64_t)(timeMs * 1000);
+        if (strcmp(command, "on") == 0 && fields >= 3) {
+            uint8_t velocity = (fields == 4) ? b : 100;
+            uint8_t packet[4] = { 0x09, 0x90, (uint8_t)(a & 0x7F), (uint8_t)(velocity & 0x7F) };
+            memcpy(event.payload, packet, 4);
+            event.type = HOST_MIDI;
+            event.length = 4;
+        } else if (strcmp(command, "off") == 0 && fields >= 3) {
+            uint8_t packet[4] = { 0x08, 0x80, (uint8_t)(a & 0x7F), 0 };
+            memcpy(event.payload, packet, 4);
+            event.type = HOST_MIDI;
+            event.length = 4;
+        } else if (strcmp(command, "knob") == 0 && fields == 4 && a >= 0 && a < HOST_PARAM_PAN_MODE) {
+            uint8_t param[3] = { (uint8_t)a, (uint8_t)(b & 0xFF), (uint8_t)((b >> 8) & 0xFF) };
+            memcpy(event.payload, param, 3);
+            event.type = HOST_PARAM;
+            event.length = 3;
+        } else if (strcmp(command, "pan") == 0 || strcmp(command, "dither") == 0) {
+            const char* panModes[] = { "key", "module", "random", NULL };
+            const char* ditherModes[] = { "off", "tpdf", "shaped", NULL };
+            bool pan = (command[0] == 'p');
+            const char** modes = pan ? panModes : ditherModes;
+            char mode[16] = "";
+            sscanf(line, "%*f %*s %15s", mode);
+            int index = -1;
+            for (int i = 0; modes[i]; i++) {
+                if (strcmp(mode, modes[i]) == 0) index = i;
+            }
+            if (index < 0) {
+                fprintf(stderr, "%s:%d: unknown %s mode \"%s\"\n", path, lineNumber, command, mode);
+                fclose(input);
+                return false;
+            }
+            uint8_t param[3] = { (uint8_t)(pan ? HOST_PARAM_PAN_MODE : HOST_PARAM_DITHER), (uint8_t)index, 0 };
+            memcpy(event.payload, param, 3);
+            event.type = HOST_PARAM;
+            event.length = 3;
+        } else if (strcmp(command, "ping") == 0) {
+            event.type = HOST_PING;
+        } else {
+            fprintf(stderr, "%s:%d: cannot parse \"%s\"\n", path, lineNumber, command);
+            fclose(input);
+            return false;
+        }
+        events.push_back(event);
+    }
+    fclose(input);
+    std::stable_sort(events.begin(), events.end(),
+                     [](const Event &x, const Event &y) { return x.timeUs < y.timeUs; });
+    return true;
+}
+
+// Ping until the module answers and reports its counters, so the final
+// telemetry can be compared with what this run sent
+static bool connect(Link &link, HostTelemetry &baseline) {
+    for (int attempt = 0; attempt < 10; attempt++) {
+        size_t pongs = link.rttUs.size();
+        sendPing(link);
+        uint32_t telemetryCount = link.telemetryCount;
+        receiveUntil(link, nowUs() + 3 * PING_PERIOD_US);
+        if (link.rttUs.size() > pongs && link.telemetryCount > telemetryCount) {
+            baseline = link.telemetry;
+            link.txFrames = 0;
+            link.txBytes = 0;
+            link.rttUs.clear();
+            return true;
+        }
+    }
+    fprintf(stderr, "No reply from the module\n");
+    return false;
+}
+
+static void replay(Link &link, const std::vector<Event> &events, uint64_t &maxLateUs) {
+    uint64_t start = nowUs();
+    uint64_t nextPing = start;
+    maxLateUs = 0;
+    for (const Event &event : events) {
+        uint64_t due = start + event.timeUs;
+        while (true) {
+            uint64_t now = nowUs();
+            if (now >= nextPing && nextPing <= due) {
+                sendPing(link);
+                nextPing += PING_PERIOD_US;
+                continue;
+            }
+            if (now >= due) break;
+            receive(link, std::min(due, nextPing) - now);
+        }
+        uint64_t late = nowUs() - due;
+        if (late > maxLateUs) maxLateUs = late;
+        if (event.type == HOST_PING) sendPing(link);
+        else sendFrame(link, event.type, event.payload, event.length);
+    }
+}
+
+static void flood(Link &link, uint32_t count) {
+    uint8_t payload[HOST_MAX_PAYLOAD];
+    for (uint8_t i = 0; i < HOST_MAX_PAYLOAD; i++) payload[i] = i;
+    for (uint32_t i = 0; i < count; i++) {
+        sendFrame(link, HOST_NOP, payload, sizeof(payload));
+        // Keep the receive side drained so pongs and telemetry are not lost
+        receive(link, 0);
+    }
+    tcdrain(link.fd);
+}
+
+static void printRtt(std::vector<uint64_t> rtt) {
+    if (rtt.empty()) {
+        printf("Round trip:       no pongs\n");
+        return;
+    }
+    std::sort(rtt.begin(), rtt.end());
+    uint64_t total = 0;
+    for (uint64_t r : rtt) total += r;
+    printf("Round trip (us):  min %llu, mean %llu, p99 %llu, max %llu over %zu pings\n",
+           (unsigned long long)rtt.front(), (unsigned long long)(total / rtt.size()),
+           (unsigned long long)rtt[rtt.size() * 99 / 100], (unsigned long long)rtt.back(), rtt.size());
+}
+
+int main(int argc, char** argv) {
+    const char* port = NULL;
+    const char* script = NULL;
+    uint32_t floodCount = 0;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--flood") == 0 && i + 1 < argc) floodCount = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else if (!port) port = argv[i];
+        else script = argv[i];
+    }
+    if (!port || (!script && floodCount == 0)) {
+        fprintf(stderr, "Usage: %s <port> <script> | %s <port> --flood <frames> [-v]\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    std::vector<Event> events;
+    if (script && !parseScript(script, events)) return 2;
+
+    static Link link = {};
+    link.verbose = verbose;
+    if (!openPort(link, port, B1000000)) return 2;
+
+    HostTelemetry baseline;
+    if (!connect(link, baseline)) return 1;
+
+    uint64_t start = nowUs();
+    uint64_t maxLateUs = 0;
+    if (floodCount > 0) flood(link, floodCount);
+    else replay(link, events, maxLateUs);
+    uint64_t elapsed = nowUs() - start;
+    uint64_t framesSent = link.txFrames;
+    uint64_t bytesSent = link.txBytes;
+
+    // Let the last frames through, then ask for a final count
+    receiveUntil(link, nowUs() + SETTLE_US);
+    sendPing(link);
+    receiveUntil(link, nowUs() + 3 * PING_PERIOD_US);
+
+    uint32_t parsed = link.telemetry.rxFrames - baseline.rxFrames;
+    printf("Sent:             %llu frames, %llu bytes in %.3f s (%.1f kB/s)\n",
+           (unsigned long long)framesSent, (unsigned long long)bytesSent,
+           elapsed / 1e6, elapsed ? bytesSent * 1000.0 / elapsed : 0.0);
+    if (floodCount == 0) printf("Send lateness:    max %llu us\n", (unsigned long long)maxLateUs);
+    printRtt(link.rttUs);
+    printf("Module parsed:    %u frames, %u errors, %u overruns, %u replies dropped\n",
+           parsed, link.telemetry.rxErrors - baseline.rxErrors,
+           link.telemetry.rxOverruns - baseline.rxOverruns,
+           link.telemetry.txDropped - baseline.txDropped);
+    printf("Key events out:   %u\n", link.midiOut);
+
+    close(link.fd);
+    return (parsed == link.txFrames) ? 0 : 1;
+}
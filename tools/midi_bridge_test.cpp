@@ -0,0 +1,105 @@
+// Host-side test of the MIDI bridge.
+//
+// Replays a simulated USB-MIDI event stream through the firmware's bridge in
+// lib/MidiBridge and checks the note events it hands to the note callback,
+// which the firmware turns into note frames (type, octave, key and velocity
+// or pressure). Then mirrors local key events and checks the packets, their
+// order and the drop count when the outbound ring fills. Prints each check
+// and exits with 0 if all pass, 1 otherwise.
+//
+// Build and run from the repository root:
+//   g++ -O2 -Ilib/MidiBridge tools/midi_bridge_test.cpp lib/MidiBridge/MidiBridge.cpp -o midi_bridge_test
+//   ./midi_bridge_test
+
+#include <stdio.h>
+#include <string.h>
+#include "MidiBridge.h"
+
+struct NoteEvent {
+    char type;
+    uint8_t octave;
+    uint8_t key;
+    uint8_t value;
+};
+
+const uint8_t MAX_EVENTS = 16;
+static NoteEvent events[MAX_EVENTS];
+static uint8_t eventCount = 0;
+
+static void recordNote(char type, uint8_t octave, uint8_t key, uint8_t value) {
+    if (eventCount < MAX_EVENTS) events[eventCount] = { type, octave, key, value };
+    eventCount++;
+}
+
+static int failures = 0;
+
+static void check(bool pass, const char* what) {
+    printf("%s  %s\n", pass ? "PASS" : "FAIL", what);
+    if (!pass) failures++;
+}
+
+int main() {
+    MidiBridge_RegisterNoteCallback(recordNote);
+
+    // Inbound: the same stream as the firmware's TEST_MIDI build, plus pressure
+    const uint8_t stream[][4] = {
+        { 0x09, 0x90, 60, 100 },  // C4 on
+        { 0x09, 0x90, 64, 90 },   // E4 on
+        { 0x0B, 0xB0, 7, 127 },   // Volume CC, ignored
+        { 0x0A, 0xA0, 64, 55 },   // E4 key pressure
+        { 0x08, 0x80, 60, 0 },    // C4 off
+        { 0x09, 0x90, 64, 0 },    // E4 off as note on with velocity 0
+        { 0x09, 0x90, 5, 100 },   // Below octave 0, dropped
+        { 0x09, 0x90, 127, 100 }, // Above octave 8, dropped
+        { 0x19, 0x91, 21, 127 },  // A0 on, cable 1 and channel 2 are not filtered
+    };
+    const bool isNote[] = { true, true, false, true, true, true, true, true, true };
+    const NoteEvent expected[] = {
+        { 'P', 4, 0, 100 }, { 'P', 4, 4, 90 }, { 'A', 4, 4, 55 },
+        { 'R', 4, 0, 0 }, { 'R', 4, 4, 0 }, { 'P', 0, 9, 127 },
+    };
+    const uint8_t STREAM_LEN = sizeof(stream) / sizeof(stream[0]);
+    const uint8_t EXPECTED_LEN = sizeof(expected) / sizeof(expected[0]);
+
+    bool classified = true;
+    for (uint8_t i = 0; i < STREAM_LEN; i++) {
+        if (MidiBridge_Receive(stream[i]) != isNote[i]) classified = false;
+    }
+    check(classified, "note packets are reported as handled, others are not");
+    check(eventCount == EXPECTED_LEN, "out-of-range notes and controllers are dropped");
+    bool matched = (eventCount == EXPECTED_LEN);
+    for (uint8_t i = 0; i < EXPECTED_LEN && matched; i++) {
+        matched = events[i].type == expected[i].type && events[i].octave == expected[i].octave &&
+                  events[i].key == expected[i].key && events[i].value == expected[i].value;
+        if (!matched) {
+            printf("      event %u: got %c %u %u %u, expected %c %u %u %u\n", i,
+                   events[i].type, events[i].octave, events[i].key, events[i].value,
+                   expected[i].type, expected[i].octave, expected[i].key, expected[i].value);
+        }
+    }
+    check(matched, "note events carry the type, octave, key and velocity");
+
+    // Outbound: local keys go out as note on/off packets, oldest first
+    MidiPacket out;
+    check(!MidiBridge_TakePacket(out), "outbound ring starts empty");
+    MidiBridge_MirrorKey(true, 69);
+    MidiBridge_MirrorKey(false, 69);
+    const uint8_t noteOn[4] = { 0x09, 0x90, 69, MIDI_KEY_VELOCITY };
+    const uint8_t noteOff[4] = { 0x08, 0x80, 69, 0 };
+    check(MidiBridge_TakePacket(out) && memcmp(out.data, noteOn, 4) == 0, "key press is a note on");
+    check(MidiBridge_TakePacket(out) && memcmp(out.data, noteOff, 4) == 0, "key release is a note off");
+    check(!MidiBridge_TakePacket(out), "ring is empty after draining");
+
+    // One slot stays free to tell a full ring from an empty one
+    const uint8_t CAPACITY = MIDI_OUT_RING_SIZE - 1;
+    for (uint8_t i = 0; i < CAPACITY + 3; i++) MidiBridge_MirrorKey(true, 36 + i);
+    check(MidiBridge_GetDroppedCount() == 3, "events beyond the ring's capacity are counted as dropped");
+    bool ordered = true;
+    for (uint8_t i = 0; i < CAPACITY; i++) {
+        if (!MidiBridge_TakePacket(out) || out.data[2] != 36 + i) ordered = false;
+    }
+    check(ordered && !MidiBridge_TakePacket(out), "a full ring keeps the oldest events in order");
+
+    printf("\n%s\n", failures ? "FAILED" : "All checks passed");
+    return failures ? 1 : 0;
+}
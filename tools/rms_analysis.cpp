@@ -0,0 +1,71 @@
+// Host-side rate-monotonic / response-time analysis.
+//
+// Reads task lines "name,priority,period_us,wcet_us[,deadline_us,...]" from a CSV file
+// (or stdin) and prints the same analysis the firmware reports with
+// MEASURE_TASK_TIMES, using the shared code in lib/Schedulability. Any other
+// lines are ignored, so a captured serial log can be passed in directly.
+//
+// Build and run from the repository root:
+//   g++ -O2 -Ilib/Schedulability tools/rms_analysis.cpp lib/Schedulability/Schedulability.cpp -o rms_analysis
+//   ./rms_analysis timings.csv
+
+#include <stdio.h>
+#include <string.h>
+#include "Schedulability.h"
+
+const uint8_t MAX_TASKS = 32;
+const uint8_t NAME_SIZE = 32;
+
+int main(int argc, char** argv) {
+    FILE* input = stdin;
+    if (argc > 1) {
+        input = fopen(argv[1], "r");
+        if (!input) {
+            perror(argv[1]);
+            return 2;
+        }
+    }
+
+    SchedTask tasks[MAX_TASKS];
+    char names[MAX_TASKS][NAME_SIZE];
+    uint8_t count = 0;
+
+    // A later line for the same task replaces the earlier one, so a log with
+    // several reports is analysed with its latest measurements
+    char line[256];
+    while (fgets(line, sizeof(line), input)) {
+        SchedTask task;
+        char name[NAME_SIZE];
+        if (!Sched_ParseCSV(line, task, name, NAME_SIZE)) continue;
+
+        uint8_t i = 0;
+        while (i < count && strcmp(names[i], name) != 0) i++;
+        if (i == MAX_TASKS) {
+            fprintf(stderr, "Too many tasks, ignoring %s\n", name);
+            continue;
+        }
+        if (i == count) count++;
+        strcpy(names[i], name);
+        tasks[i] = task;
+        tasks[i].name = names[i];
+    }
+    if (input != stdin) fclose(input);
+
+    if (count == 0) {
+        fprintf(stderr, "No task lines found\n");
+        return 2;
+    }
+
+    SchedResult result = Sched_Analyse(tasks, count);
+
+    Sched_FormatHeader(line, sizeof(line));
+    puts(line);
+    for (uint8_t i = 0; i < count; i++) {
+        Sched_FormatTask(tasks[i], line, sizeof(line));
+        puts(line);
+    }
+    Sched_FormatResult(result, line, sizeof(line));
+    puts(line);
+
+    return result.schedulable ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+// Host-side benchmark and response check for the per-voice filter.
+//
+// Runs the firmware's filter code from lib/SVF over a block of sawtooth voices
+// and reports the cost per sample per voice, the cost of a coefficient update,
+// and the measured low-pass response at a few resonance settings. Cycle counts
+// come from the time-stamp counter on x86 hosts; elsewhere only nanoseconds are
+// printed. Host numbers rank changes to the filter; multiply by the voice count
+// and the sample rate to compare against the sample ISR budget on the target.
+//
+// Build and run from the repository root:
+//   g++ -O2 -Ilib/SVF tools/svf_bench.cpp lib/SVF/SVF.cpp -o svf_bench
+//   ./svf_bench [voices] [sample_rate]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "SVF.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+static uint64_t cycles() { return __rdtsc(); }
+#else
+#define HAVE_CYCLES 0
+static uint64_t cycles() { return 0; }
+#endif
+
+const uint8_t MAX_VOICES = 32;
+const uint32_t BLOCK = 32;             // Samples per control block, as in the firmware
+const uint32_t BENCH_SAMPLES = 1 << 20;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t stepFor(double frequency, uint32_t rate) {
+    return (uint32_t)(4294967296.0 * frequency / rate);
+}
+
+// Peak output of a filter fed a full-scale sine, after it settles
+static int32_t sinePeak(uint32_t cutoff, int32_t resonance, double frequency, uint32_t rate) {
+    SVF filter;
+    SVF_Reset(filter);
+    SVF_Tune(filter, cutoff, resonance);
+    int32_t peak = 0;
+    uint32_t length = rate / 2;
+    for (uint32_t n = 0; n < length; n++) {
+        int32_t sample = (int32_t)lrint(127.0 * sin(6.283185307179586 * frequency * n / rate));
+        int32_t out = SVF_Process(filter, sample);
+        if (n > length / 2 && abs(out) > peak) peak = abs(out);
+    }
+    return peak;
+}
+
+int main(int argc, char** argv) {
+    uint32_t voices = (argc > 1) ? atoi(argv[1]) : 12;
+    uint32_t rate = (argc > 2) ? atoi(argv[2]) : 22050;
+    if (voices < 1 || voices > MAX_VOICES || rate == 0) {
+        fprintf(stderr, "usage: %s [voices 1-%u] [sample_rate]\n", argv[0], MAX_VOICES);
+        return 2;
+    }
+
+    // Sawtooth voices a few semitones apart, each with its own cutoff
+    SVF filters[MAX_VOICES];
+    uint32_t phase[MAX_VOICES] = {};
+    uint32_t step[MAX_VOICES];
+    for (uint32_t v = 0; v < voices; v++) {
+        SVF_Reset(filters[v]);
+        step[v] = stepFor(220.0 * pow(2.0, v / 4.0), rate);
+        SVF_Tune(filters[v], step[v] * 4, 16384);
+    }
+
+    // Sample loop: oscillator plus filter, against the oscillator alone
+    volatile int32_t sink = 0;
+    uint64_t loopCycles[2];
+    uint64_t loopNs[2];
+    for (int pass = 0; pass < 2; pass++) {
+        bool filtered = (pass == 1);
+        uint64_t startNs = nowNs();
+        uint64_t start = cycles();
+        for (uint32_t n = 0; n < BENCH_SAMPLES; n++) {
+            int32_t mix = 0;
+            for (uint32_t v = 0; v < voices; v++) {
+                phase[v] += step[v];
+                int32_t sample = (int32_t)(phase[v] >> 24) - 128;
+                mix += filtered ? SVF_Process(filters[v], sample) : sample;
+            }
+            sink = sink + mix;
+        }
+        loopCycles[pass] = cycles() - start;
+        loopNs[pass] = nowNs() - startNs;
+    }
+
+    // Coefficient updates, each with a new cutoff so none is skipped
+    const uint32_t TUNES = 1 << 16;
+    uint64_t startNs = nowNs();
+    uint64_t start = cycles();
+    for (uint32_t t = 0; t < TUNES; t++) {
+        SVF_Tune(filters[t % voices], stepFor(100.0 + t % 5000, rate), t & 0x7FFF);
+    }
+    uint64_t tuneCycles = cycles() - start;
+    uint64_t tuneNs = nowNs() - startNs;
+
+    double perVoice = (double)BENCH_SAMPLES * voices;
+    printf("%u voices, %u samples at %u Hz\n", voices, BENCH_SAMPLES, rate);
+    printf("%-22s %10s %10s\n", "", "ns", HAVE_CYCLES ? "cycles" : "");
+    printf("%-22s %10.2f", "oscillator", loopNs[0] / perVoice);
+    if (HAVE_CYCLES) printf(" %10.2f", loopCycles[0] / perVoice);
+    printf("\n%-22s %10.2f", "oscillator + filter", loopNs[1] / perVoice);
+    if (HAVE_CYCLES) printf(" %10.2f", loopCycles[1] / perVoice);
+    printf("\n%-22s %10.2f", "filter only", (loopNs[1] - (double)loopNs[0]) / perVoice);
+    if (HAVE_CYCLES) printf(" %10.2f", (loopCycles[1] - (double)loopCycles[0]) / perVoice);
+    printf("   per sample per voice\n%-22s %10.2f", "coefficient update", (double)tuneNs / TUNES);
+    if (HAVE_CYCLES) printf(" %10.2f", (double)tuneCycles / TUNES);
+    printf("   per change (at most one per voice per %u samples)\n\n", BLOCK);
+
+    // Response at 1 kHz cutoff: passband, cutoff, one octave above
+    double cutoffHz = 1000.0;
+    uint32_t cutoff = stepFor(cutoffHz, rate);
+    printf("Low-pass response, cutoff %.0f Hz (peak output for a 127 sine)\n", cutoffHz);
+    printf("%-12s %8s %8s %8s %8s\n", "resonance", "100 Hz", "1 kHz", "2 kHz", "4 kHz");
+    const int32_t resonances[] = { 0, 16384, 32767 };
+    for (int32_t resonance : resonances) {
+        printf("%-12d %8d %8d %8d %8d\n", resonance,
+               sinePeak(cutoff, resonance, 100.0, rate),
+               sinePeak(cutoff, resonance, cutoffHz, rate),
+               sinePeak(cutoff, resonance, cutoffHz * 2, rate),
+               sinePeak(cutoff, resonance, cutoffHz * 4, rate));
+    }
+
+    // Full resonance at the highest cutoff must stay bounded
+    int32_t worst = sinePeak(SVF_MAX_CUTOFF, 32767, rate / 6.0, rate);
+    printf("\nMaximum cutoff, full resonance: peak %d (state limit %d)\n",
+           worst, SVF_STATE_LIMIT >> SVF_SAMPLE_SHIFT);
+    return 0;
+}